@@ -0,0 +1,227 @@
+/*** rand-pool.c -- pre-generated randomness
+ *
+ * Copyright (C) 2008-2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@fresse.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rand.h"
+#include "rand-taus.h"
+#include "rand-pool.h"
+#include "nifty.h"
+
+struct dr_pool_buf_s {
+	float *d;
+	bool fullp;
+};
+
+struct dr_pool_strm_s {
+	size_t z;
+	/* the buffer we're consuming from and the offset therein */
+	unsigned int cur;
+	size_t off;
+	struct dr_pool_buf_s b[2U];
+};
+
+struct dr_pool_s {
+	pthread_t th;
+	pthread_mutex_t mtx;
+	/* signalled by consumers when a buffer has been drained */
+	pthread_cond_t drnd;
+	/* signalled by the service thread when a buffer has been filled */
+	pthread_cond_t fild;
+	bool quitp;
+	struct dr_pool_strm_s s[DR_POOL_NSTRMS];
+};
+
+
+static void
+fill(float *restrict tgt, dr_pool_strm_t s, size_t z)
+{
+	switch (s) {
+	case DR_POOL_UNI:
+		dr_rand_uni_n(tgt, z);
+		break;
+	case DR_POOL_NORM:
+		dr_rand_norm_n(tgt, z);
+		break;
+	default:
+		break;
+	}
+	return;
+}
+
+static struct dr_pool_buf_s*
+find_drained(struct dr_pool_s *p, dr_pool_strm_t *s)
+{
+	for (dr_pool_strm_t i = DR_POOL_UNI; i < DR_POOL_NSTRMS; i++) {
+		if (p->s[i].z == 0U) {
+			continue;
+		}
+		for (unsigned int j = 0U; j < countof(p->s[i].b); j++) {
+			if (!p->s[i].b[j].fullp) {
+				*s = i;
+				return p->s[i].b + j;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void*
+serve(void *clo)
+{
+	struct dr_pool_s *p = clo;
+
+	/* generator states are per thread, seed ours */
+	init_rand_taus();
+
+	pthread_mutex_lock(&p->mtx);
+	while (!p->quitp) {
+		struct dr_pool_buf_s *b;
+		dr_pool_strm_t s;
+
+		if ((b = find_drained(p, &s)) == NULL) {
+			pthread_cond_wait(&p->drnd, &p->mtx);
+			continue;
+		}
+		/* generate without holding the lock */
+		pthread_mutex_unlock(&p->mtx);
+		fill(b->d, s, p->s[s].z);
+		pthread_mutex_lock(&p->mtx);
+
+		b->fullp = true;
+		pthread_cond_signal(&p->fild);
+	}
+	pthread_mutex_unlock(&p->mtx);
+	return NULL;
+}
+
+
+dr_pool_t
+make_dr_pool(size_t nuni, size_t nnorm)
+{
+	struct dr_pool_s *res;
+
+	if (UNLIKELY((res = calloc(1, sizeof(*res))) == NULL)) {
+		return NULL;
+	}
+	res->s[DR_POOL_UNI].z = nuni;
+	res->s[DR_POOL_NORM].z = nnorm;
+	for (dr_pool_strm_t i = DR_POOL_UNI; i < DR_POOL_NSTRMS; i++) {
+		struct dr_pool_strm_s *s = res->s + i;
+
+		if (s->z == 0U) {
+			continue;
+		}
+		for (unsigned int j = 0U; j < countof(s->b); j++) {
+			if ((s->b[j].d = malloc(s->z * sizeof(float))) == NULL) {
+				goto free;
+			}
+		}
+		/* start out drained */
+		s->off = s->z;
+	}
+
+	pthread_mutex_init(&res->mtx, NULL);
+	pthread_cond_init(&res->drnd, NULL);
+	pthread_cond_init(&res->fild, NULL);
+	if (pthread_create(&res->th, NULL, serve, res) != 0) {
+		pthread_cond_destroy(&res->fild);
+		pthread_cond_destroy(&res->drnd);
+		pthread_mutex_destroy(&res->mtx);
+		goto free;
+	}
+	return res;
+
+free:
+	for (dr_pool_strm_t i = DR_POOL_UNI; i < DR_POOL_NSTRMS; i++) {
+		free(res->s[i].b[0U].d);
+		free(res->s[i].b[1U].d);
+	}
+	free(res);
+	return NULL;
+}
+
+void
+free_dr_pool(dr_pool_t p)
+{
+	if (UNLIKELY(p == NULL)) {
+		return;
+	}
+	pthread_mutex_lock(&p->mtx);
+	p->quitp = true;
+	pthread_cond_signal(&p->drnd);
+	pthread_mutex_unlock(&p->mtx);
+	pthread_join(p->th, NULL);
+
+	pthread_cond_destroy(&p->fild);
+	pthread_cond_destroy(&p->drnd);
+	pthread_mutex_destroy(&p->mtx);
+	for (dr_pool_strm_t i = DR_POOL_UNI; i < DR_POOL_NSTRMS; i++) {
+		free(p->s[i].b[0U].d);
+		free(p->s[i].b[1U].d);
+	}
+	free(p);
+	return;
+}
+
+const float*
+dr_pool_take(dr_pool_t p, dr_pool_strm_t s, size_t n)
+{
+	struct dr_pool_strm_s *st = p->s + s;
+	const float *res;
+
+	if (UNLIKELY(n > st->z)) {
+		return NULL;
+	} else if (UNLIKELY(st->off + n > st->z)) {
+		/* hand the current buffer back and switch to the other one */
+		pthread_mutex_lock(&p->mtx);
+		st->b[st->cur].fullp = false;
+		pthread_cond_signal(&p->drnd);
+		st->cur ^= 1U;
+		while (!st->b[st->cur].fullp) {
+			pthread_cond_wait(&p->fild, &p->mtx);
+		}
+		pthread_mutex_unlock(&p->mtx);
+		st->off = 0U;
+	}
+	res = st->b[st->cur].d + st->off;
+	st->off += n;
+	return res;
+}
+
+/* rand-pool.c ends here */
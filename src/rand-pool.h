@@ -0,0 +1,72 @@
+/*** rand-pool.h -- pre-generated randomness
+ *
+ * Copyright (C) 2008-2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@fresse.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if !defined INCLUDED_rand_pool_h_
+#define INCLUDED_rand_pool_h_
+
+#include <stddef.h>
+
+/**
+ * A pool of random numbers, generated ahead of time by a service thread.
+ * Every stream in the pool is double-buffered, while the consumer takes
+ * from one buffer the service thread refills the other.
+ * Pools are meant for exactly one consuming thread. */
+typedef struct dr_pool_s *dr_pool_t;
+
+typedef enum {
+	/** uniforms in [0,1] as per dr_rand_uni() */
+	DR_POOL_UNI,
+	/** unit gaussians as per dr_rand_norm() */
+	DR_POOL_NORM,
+	/** not a stream */
+	DR_POOL_NSTRMS,
+} dr_pool_strm_t;
+
+/**
+ * Create a pool and start its service thread.
+ * Buffers hold NUNI uniforms and NNORM normals respectively, a stream
+ * of size 0 is not served at all. */
+extern dr_pool_t make_dr_pool(size_t nuni, size_t nnorm);
+
+/**
+ * Stop the service thread of P and free all resources. */
+extern void free_dr_pool(dr_pool_t p);
+
+/**
+ * Return a pointer to N consecutive samples from stream S of pool P.
+ * N must not exceed the buffer size the stream was created with.
+ * The samples stay valid until the next call for the same stream. */
+extern const float *dr_pool_take(dr_pool_t p, dr_pool_strm_t s, size_t n);
+
+#endif	/* INCLUDED_rand_pool_h_ */
@@ -79,6 +79,7 @@
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
+#include <string.h>
 #include <math.h>
 #include "rand.h"
 #include "rand-taus.h"
@@ -96,14 +97,30 @@ struct taus_state_s {
 };
 
 /**
- * \private Internal state of the Tausworthe PRNG. */
-static struct taus_state_s state = {
+ * \private Internal state of the Tausworthe PRNG, one per thread. */
+static __thread struct taus_state_s state = {
 	.s1 = 69069,
 	.s2 = 475559465,
 	.s3 = 2801775573,
 };
 
+/**
+ * \private Number of lanes of the vectorised generator. */
+#define TAUS_NLANES	8U
+
+/**
+ * \private A vector of independent Tausworthe states. */
+typedef unsigned int taus_v_t
+__attribute__((vector_size(TAUS_NLANES * sizeof(unsigned int))));
+
+/**
+ * \private Lane-wise state, seeded off the scalar generator. */
+static __thread struct {
+	taus_v_t s1, s2, s3;
+} vstate;
+
 static inline unsigned int __taus(void) __attribute__((always_inline));
+static inline void __taus_v(taus_v_t*) __attribute__((always_inline));
 
 static inline unsigned int
 __taus(void)
@@ -116,6 +133,18 @@ __taus(void)
 	return (state.s1 ^ state.s2 ^ state.s3);
 }
 
+static inline void
+__taus_v(taus_v_t *restrict tgt)
+{
+/* same as __taus() in TAUS_NLANES lanes, int is 32 bits so no masking */
+#define TAUSWORTHE_V(s,a,b,c,d)	(((s & c) << d) ^ (((s << a) ^ s) >> b))
+	vstate.s1 = TAUSWORTHE_V(vstate.s1, 13, 19, 4294967294U, 12);
+	vstate.s2 = TAUSWORTHE_V(vstate.s2, 2, 25, 4294967288U, 4);
+	vstate.s3 = TAUSWORTHE_V(vstate.s3, 3, 11, 4294967280U, 17);
+	*tgt = vstate.s1 ^ vstate.s2 ^ vstate.s3;
+	return;
+}
+
 #if defined USE_TAUS_GENERATOR || 1
 long int
 dr_rand_long(void)
@@ -141,8 +170,54 @@ dr_rand_int(void)
 {
 	return (int)(__taus());
 }
+
+static void taus_seed_v(void);
+
+void
+dr_rand_int_n(unsigned int *tgt, size_t n)
+{
+	size_t i = 0U;
+
+	if (__builtin_expect(!vstate.s1[0U], 0)) {
+		/* never seeded, an all-zero state stays all-zero */
+		taus_seed_v();
+	}
+
+	for (taus_v_t x; i + TAUS_NLANES <= n; i += TAUS_NLANES) {
+		__taus_v(&x);
+		memcpy(tgt + i, &x, sizeof(x));
+	}
+	if (i < n) {
+		taus_v_t x;
+
+		__taus_v(&x);
+		memcpy(tgt + i, &x, (n - i) * sizeof(*tgt));
+	}
+	return;
+}
 #endif	/* USE_TAUS_GENERATOR */
 
+static void
+taus_seed_v(void)
+{
+	taus_v_t x;
+
+	/* seed the lanes off the scalar stream, minding the lower bounds */
+	for (unsigned int i = 0; i < TAUS_NLANES; i++) {
+		vstate.s1[i] = __taus() | 2U;
+		vstate.s2[i] = __taus() | 8U;
+		vstate.s3[i] = __taus() | 16U;
+	}
+	/* and warm them up as well */
+	__taus_v(&x);
+	__taus_v(&x);
+	__taus_v(&x);
+	__taus_v(&x);
+	__taus_v(&x);
+	__taus_v(&x);
+	return;
+}
+
 #if 1
 /* this would have been the procedure
  * however we just computed the stuff manually
@@ -180,6 +255,9 @@ taus_set(long unsigned int s)
 	__taus();
 	__taus();
 	__taus();
+
+	/* and the lanes */
+	taus_seed_v();
 	return;
 }
 #endif	/* 0 */
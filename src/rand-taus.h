@@ -39,7 +39,9 @@
 /**
  * Initialise the Tausworthe PRNG.
  * This is a high-performance, mediocre quality, mediocre period
- * pseudo random number generator. */
+ * pseudo random number generator.
+ * Generator states are per thread, every thread that wants randomness
+ * has to call this. */
 extern void init_rand_taus(void);
 
 /**
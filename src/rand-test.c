@@ -2,15 +2,270 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <math.h>
 #include "rand.h"
 #include "nifty.h"
 
+/* running moments of a sample, and its range */
+struct mom_s {
+	size_t n;
+	double s1, s2, s3, s4;
+	double lo, hi;
+};
+
+static void
+mom_add(struct mom_s *restrict m, double x)
+{
+	const double x2 = x * x;
+
+	if (!m->n++) {
+		m->lo = m->hi = x;
+	}
+	m->lo = x < m->lo ? x : m->lo;
+	m->hi = x > m->hi ? x : m->hi;
+	m->s1 += x;
+	m->s2 += x2;
+	m->s3 += x2 * x;
+	m->s4 += x2 * x2;
+	return;
+}
+
+static int
+mom_chk(const char *what, const struct mom_s *m, double mu, double var)
+{
+/* compare M's mean and variance against MU and VAR, allowing for 6
+ * standard errors either way, the variance's standard error comes
+ * from the sample's own fourth central moment */
+	const double n = (double)m->n;
+	const double a = m->s1 / n;
+	const double v = m->s2 / n - a * a;
+	const double m4 = m->s4 / n - 4. * a * m->s3 / n +
+		6. * a * a * m->s2 / n - 3. * a * a * a * a;
+	const double ea = 6. * sqrt(var / n) + 1e-9;
+	const double ev = 6. * sqrt(fabs(m4 - v * v) / n) + 1e-9;
+	int rc = 0;
+
+	if (fabs(a - mu) > ea) {
+		fprintf(stderr, "%s: mean %g, expected %g +/- %g\n",
+			what, a, mu, ea);
+		rc = 1;
+	}
+	if (fabs(v - var) > ev) {
+		fprintf(stderr, "%s: variance %g, expected %g +/- %g\n",
+			what, v, var, ev);
+		rc = 1;
+	}
+	return rc;
+}
+
+static int
+cnt_chk(const char *what, float x, double hi)
+{
+/* X must be a count in [0, HI] */
+	if (!(x >= 0.f && x <= hi && x == floorf(x))) {
+		fprintf(stderr, "%s: %g is not a count in [0, %g]\n",
+			what, x, hi);
+		return 1;
+	}
+	return 0;
+}
+
+static double
+poiss_hi(double lambda)
+{
+/* no Poisson count beyond this, give or take 1e-20 */
+	return lambda + 12. * sqrt(lambda) + 12.;
+}
+
+static int
+chk_poiss(float lambda, size_t n)
+{
+	struct mom_s m = {0U};
+	const double hi = poiss_hi(lambda);
+	char what[64U];
+
+	snprintf(what, sizeof(what), "dr_rand_poiss(%g)", lambda);
+	for (size_t i = 0; i < n; i++) {
+		const float x = dr_rand_poiss(lambda);
+
+		if (cnt_chk(what, x, hi)) {
+			return 1;
+		}
+		mom_add(&m, x);
+	}
+	return mom_chk(what, &m, lambda, lambda);
+}
+
+static int
+chk_poiss_n(float lambda, size_t n)
+{
+	static float x[4096U];
+	struct mom_s m = {0U};
+	const double hi = poiss_hi(lambda);
+	char what[64U];
+
+	snprintf(what, sizeof(what), "dr_rand_poiss_n(%g)", lambda);
+	for (size_t i = 0; i < n; i += countof(x)) {
+		dr_rand_poiss_n(x, countof(x), lambda);
+		for (size_t j = 0; j < countof(x); j++) {
+			if (cnt_chk(what, x[j], hi)) {
+				return 1;
+			}
+			mom_add(&m, x[j]);
+		}
+	}
+	return mom_chk(what, &m, lambda, lambda);
+}
+
+static int
+chk_binom(unsigned int k, float p, size_t n)
+{
+	struct mom_s m = {0U};
+	char what[64U];
+
+	snprintf(what, sizeof(what), "dr_rand_binom(%u, %g)", k, p);
+	for (size_t i = 0; i < n; i++) {
+		const float x = dr_rand_binom(k, p);
+
+		if (cnt_chk(what, x, k)) {
+			return 1;
+		}
+		mom_add(&m, x);
+	}
+	return mom_chk(what, &m, (double)k * p, (double)k * p * (1. - p));
+}
+
+static int
+chk_poiss_sp(float lcold, float lhot, float thresh, size_t n)
+{
+/* units alternate between rates LCOLD and LHOT, the zeros the sampler
+ * skips count towards the moments too */
+	static float lambda[1024U];
+	static size_t idx[countof(lambda)];
+	static float val[countof(lambda)];
+	struct mom_s m[2U] = {{0U}, {0U}};
+	const double hi = poiss_hi(lhot > lcold ? lhot : lcold);
+	char what[64U];
+	int rc = 0;
+
+	snprintf(what, sizeof(what), "dr_rand_poiss_sp(%g/%g, %g)",
+		 lcold, lhot, thresh);
+	for (size_t i = 0; i < countof(lambda); i++) {
+		lambda[i] = i % 2U ? lhot : lcold;
+	}
+	for (size_t r = 0; r < n; r += countof(lambda)) {
+		const size_t nz = dr_rand_poiss_sp(
+			idx, val, lambda, countof(lambda), thresh);
+		size_t i = 0U;
+
+		for (size_t k = 0; k < nz; k++, i++) {
+			if (idx[k] < i || idx[k] >= countof(lambda)) {
+				fprintf(stderr, "%s: index %zu out of order\n",
+					what, idx[k]);
+				return 1;
+			} else if (cnt_chk(what, val[k], hi) || !val[k]) {
+				fprintf(stderr, "%s: bad count at %zu\n",
+					what, idx[k]);
+				return 1;
+			}
+			for (; i < idx[k]; i++) {
+				mom_add(m + i % 2U, 0.);
+			}
+			mom_add(m + i % 2U, val[k]);
+		}
+		for (; i < countof(lambda); i++) {
+			mom_add(m + i % 2U, 0.);
+		}
+	}
+	rc |= mom_chk(what, m + 0U, lcold, lcold);
+	rc |= mom_chk(what, m + 1U, lhot, lhot);
+	return rc;
+}
+
+static int
+chk_norm_n(size_t z, size_t n)
+{
+/* Z normals per call, so odd Z exercise the leftover lanes,
+ * also the mass beyond 3 sigmas, where wedges and tail take over */
+	static float x[4099U];
+	struct mom_s m = {0U};
+	struct mom_s t = {0U};
+	const double pt = erfc(3. / sqrt(2.));
+	char what[64U];
+	int rc = 0;
+
+	snprintf(what, sizeof(what), "dr_rand_norm_n(%zu)", z);
+	for (size_t i = 0; i < n; i += z) {
+		dr_rand_norm_n(x, z);
+		for (size_t j = 0; j < z; j++) {
+			if (!(fabsf(x[j]) < 12.f)) {
+				fprintf(stderr, "%s: %g out of range\n",
+					what, x[j]);
+				return 1;
+			}
+			mom_add(&m, x[j]);
+			mom_add(&t, fabsf(x[j]) > 3.f);
+		}
+	}
+	rc |= mom_chk(what, &m, 0., 1.);
+	rc |= mom_chk(what, &t, pt, pt * (1. - pt));
+	return rc;
+}
+
+static int
+chk_all(void)
+{
+/* small rates are run for long, they go wrong in the far tail */
+	int rc = 0;
+
+	/* inversion */
+	rc |= chk_poiss(0.001f, 1U << 26U);
+	rc |= chk_poiss(3.f, 1U << 22U);
+	rc |= chk_poiss(9.5f, 1U << 20U);
+	/* PTRS */
+	rc |= chk_poiss(10.f, 1U << 20U);
+	rc |= chk_poiss(30.f, 1U << 20U);
+	rc |= chk_poiss(1000.f, 1U << 20U);
+	/* table lookup */
+	rc |= chk_poiss_n(0.001f, 1U << 26U);
+	rc |= chk_poiss_n(3.f, 1U << 24U);
+	rc |= chk_poiss_n(9.5f, 1U << 20U);
+	/* PTRS with shared constants */
+	rc |= chk_poiss_n(50.f, 1U << 20U);
+	/* inversion, on either face */
+	rc |= chk_binom(20U, 0.1f, 1U << 20U);
+	rc |= chk_binom(20U, 0.9f, 1U << 20U);
+	rc |= chk_binom(1000000U, 0.000001f, 1U << 22U);
+	/* BTRS */
+	rc |= chk_binom(100U, 0.3f, 1U << 20U);
+	rc |= chk_binom(1000000U, 0.5f, 1U << 20U);
+	rc |= chk_binom(4000000000U, 0.999f, 1U << 20U);
+	/* skipping cold units, sampling hot ones */
+	rc |= chk_poiss_sp(0.001f, 0.5f, 0.1f, 1U << 24U);
+	rc |= chk_poiss_sp(0.05f, 3.f, 0.1f, 1U << 22U);
+	/* everything cold, THRESH beyond the clamp */
+	rc |= chk_poiss_sp(0.5f, 8.f, 50.f, 1U << 22U);
+	/* nothing cold */
+	rc |= chk_poiss_sp(0.2f, 30.f, 0.f, 1U << 22U);
+	/* block ziggurat */
+	rc |= chk_norm_n(1U, 1U << 20U);
+	rc |= chk_norm_n(13U, 1U << 22U);
+	rc |= chk_norm_n(4099U, 1U << 24U);
+	return rc;
+}
+
 int
 main(int argc, char *argv[])
 {
+/* without arguments check the samplers, with a rate LAMBDA print the
+ * histogram of dr_rand_poiss(LAMBDA) */
 	static uint_fast32_t buckets[256U];
-	const float lambda = (float)(argc > 1 ? strtod(argv[1], NULL) : 1.f);
+	float lambda;
 
+	if (argc <= 1) {
+		return chk_all();
+	}
+	lambda = (float)strtod(argv[1], NULL);
 	for (size_t i = 0; i < 1000000U; i++) {
 		float x = dr_rand_poiss(lambda);
 
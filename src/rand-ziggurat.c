@@ -57,11 +57,19 @@
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
+#include <stdint.h>
 #include <math.h>
 #include <stdbool.h>
 #include "rand.h"
 #include "rand-ziggurat.h"
 
+#if !defined LIKELY
+# define LIKELY(_x)	__builtin_expect((_x), 1)
+#endif	/* !LIKELY */
+#if !defined UNLIKELY
+# define UNLIKELY(_x)	__builtin_expect((_x), 0)
+#endif	/* UNLIKELY */
+
 #define ZIG_NBLOCKS	128
 #define ZIG_R		3.442619855899
 #define ZIG_V		9.91256303526217e-3
@@ -321,6 +329,83 @@ dr_rand_norm(void)
 }
 #endif	/* USE_ORIGINAL_ZIGGURAT */
 
+/* block version of the above, the rectangle test is done lane-wise for
+ * ZIG_NLANES candidates at a time, accepted lanes are compacted into the
+ * output, rejected ones go through the wedge/tail test in float and,
+ * upon failure, are simply dropped: each lane is an attempt of its own */
+#define ZIG_NLANES	8U
+
+static inline float
+zig_slow(unsigned int i, float x)
+{
+	float y;
+
+	if (LIKELY(i < 127U)) {
+		const float y0 = ytab[i];
+		const float y1 = ytab[i + 1U];
+
+		y = y1 + (y0 - y1) * dr_rand_uni();
+	} else {
+		const float r = (float)PARAM_R;
+		const float U1 = 1.f - dr_rand_uni();
+		const float U2 = dr_rand_uni();
+
+		if (UNLIKELY(U1 <= 0.f)) {
+			return NAN;
+		}
+		x = r - logf(U1) / r;
+		y = expf(-r * (x - 0.5f * r)) * U2;
+	}
+	if (y < expf(-0.5f * x * x)) {
+		return x;
+	}
+	return NAN;
+}
+
+void
+dr_rand_norm_n(float *tgt, size_t n)
+{
+	typedef uint32_t u_v __attribute__((vector_size(ZIG_NLANES * 4U)));
+	typedef float f_v __attribute__((vector_size(ZIG_NLANES * 4U)));
+	size_t res = 0U;
+
+	while (res < n) {
+		union {
+			u_v v;
+			uint32_t u[ZIG_NLANES];
+		} k, i, j, kt;
+		union {
+			f_v v;
+			float f[ZIG_NLANES];
+		} x, w, sgn;
+
+		dr_rand_int_n(k.u, ZIG_NLANES);
+		/* step, sign and 24-bit abscissa */
+		i.v = k.v & 0x7fU;
+		j.v = k.v >> 8U;
+		sgn.v = __builtin_convertvector((k.v & 0x80U) >> 6U, f_v) - 1.f;
+		/* gather */
+		for (unsigned int l = 0; l < ZIG_NLANES; l++) {
+			w.f[l] = wtab[i.u[l]];
+			kt.u[l] = (uint32_t)ktab[i.u[l]];
+		}
+		x.v = __builtin_convertvector(j.v, f_v) * w.v;
+
+		/* compact */
+		for (unsigned int l = 0; l < ZIG_NLANES && res < n; l++) {
+			float xl = x.f[l];
+
+			if (LIKELY(j.u[l] < kt.u[l])) {
+				;
+			} else if (isnan(xl = zig_slow(i.u[l], xl))) {
+				continue;
+			}
+			tgt[res++] = sgn.f[l] * xl;
+		}
+	}
+	return;
+}
+
 float
 dr_rand_gauss(float mu, float sigma)
 {
@@ -80,6 +80,9 @@ static int _urnd_sock = -1;
 #if !defined with
 # define with(args...)	for (args, *__ep__ = (void*)1; __ep__; __ep__ = 0)
 #endif	/* !with */
+#if !defined countof
+# define countof(x)	(sizeof(x) / sizeof(*x))
+#endif	/* !countof */
 
 /*! \page rand Randomness of different qualities
  *
@@ -432,6 +435,22 @@ dr_rand_uni(void)
 	return (float)tmp / (float)((unsigned int)-1);
 }
 
+void
+dr_rand_uni_n(float *tgt, size_t n)
+{
+	unsigned int tmp[256U];
+
+	for (size_t i = 0; i < n; i += countof(tmp)) {
+		const size_t z = n - i < countof(tmp) ? n - i : countof(tmp);
+
+		dr_rand_int_n(tmp, z);
+		for (size_t j = 0; j < z; j++) {
+			tgt[i + j] = (float)tmp[j] / (float)((unsigned int)-1);
+		}
+	}
+	return;
+}
+
 /* binomial samples */
 float
 dr_rand_binom1(float /*ex*/p/*ectation*/)
@@ -444,16 +463,127 @@ dr_rand_binom1(float /*ex*/p/*ectation*/)
 	return 0.f;
 }
 
+/**
+ * Means below this are sampled by inversion, above by BTRS. */
+#define BINOM_BTRS_MIN	10.
+
+static double
+binom_fc(double k)
+{
+/* tail of Stirling's series, log(k!) - log(sqrt(2pi)(k+1)^(k+.5)e^-(k+1)) */
+	static const double tab[] = {
+		0.08106146679532726, 0.04134069595540929,
+		0.02767792568499834, 0.02079067210376509,
+		0.01664469118982119, 0.01387612882307075,
+		0.01189670994589177, 0.01041126526197209,
+		0.00925546218271273, 0.00833056343336287,
+	};
+
+	double kp1sq;
+
+	if (k < (double)countof(tab)) {
+		return tab[(size_t)k];
+	}
+	kp1sq = (k + 1.) * (k + 1.);
+	return (1. / 12. - (1. / 360. - 1. / 1260. / kp1sq) / kp1sq) / (k + 1.);
+}
+
+static double
+binom_inv(unsigned int n, double p)
+{
+/* inversion (BINV), expected cost O(np) */
+	const double q = 1. - p;
+	const double s = p / q;
+	const double a = (double)(n + 1U) * s;
+	const double r0 = pow(q, (double)n);
+
+	while (1) {
+		double u = dr_rand_uni();
+		double r = r0;
+
+		for (unsigned int k = 0U; k <= n; k++) {
+			if (u <= r) {
+				return (double)k;
+			}
+			u -= r;
+			r *= a / (double)(k + 1U) - s;
+		}
+		/* rounding left some mass behind, start afresh */
+	}
+}
+
+static double
+binom_btrs(unsigned int n, double p)
+{
+/* Hoermann, "The generation of binomial random variates",
+ * J. Statist. Comput. Simul. 46 (1993), transformed rejection */
+	const double nn = (double)n;
+	const double spq = sqrt(nn * p * (1. - p));
+	const double b = 1.15 + 2.53 * spq;
+	const double a = -0.0873 + 0.0248 * b + 0.01 * p;
+	const double c = nn * p + 0.5;
+	const double alpha = (2.83 + 5.1 / b) * spq;
+	const double vr = 0.92 - 4.2 / b;
+	const double r = p / (1. - p);
+	const double m = floor((nn + 1.) * p);
+
+	while (1) {
+		const double u = dr_rand_uni() - 0.5;
+		double v = dr_rand_uni();
+		const double us = 0.5 - fabs(u);
+		double k;
+
+		if (UNLIKELY(us <= 0.)) {
+			continue;
+		}
+		k = floor((2. * a / us + b) * u + c);
+		if (k < 0. || k > nn) {
+			continue;
+		} else if (us >= 0.07 && v <= vr) {
+			return k;
+		}
+		v = log(v * alpha / (a / (us * us) + b));
+		with (double ub =
+		      (m + 0.5) * log((m + 1.) / (r * (nn - m + 1.))) +
+		      (nn + 1.) * log((nn - m + 1.) / (nn - k + 1.)) +
+		      (k + 0.5) * log(r * (nn - k + 1.) / (k + 1.)) +
+		      binom_fc(m) + binom_fc(nn - m) -
+		      binom_fc(k) - binom_fc(nn - k)) {
+			if (v <= ub) {
+				return k;
+			}
+		}
+	}
+}
+
 float
 dr_rand_binom(unsigned int n, float /*ex*/p/*ectation*/)
 {
-/* flip N coins and sum up their faces */
-	float res = 0.f;
+/* sample the number of heads in N coin flips with bias P,
+ * in O(1) expected time regardless of N */
+	double pp = p;
+	double res;
 
-	while (n--) {
-		res += dr_rand_binom1(p);
+	if (UNLIKELY(!(p >= 0.f && p <= 1.f))) {
+		return NAN;
+	} else if (UNLIKELY(n == 0U || p == 0.f)) {
+		return 0.f;
+	} else if (UNLIKELY(p == 1.f)) {
+		return (float)n;
 	}
-	return res;
+	/* sample the rarer face, then mirror */
+	if (pp > 0.5) {
+		pp = 1. - pp;
+	}
+	if ((double)n * pp < BINOM_BTRS_MIN) {
+		res = binom_inv(n, pp);
+	} else {
+		res = binom_btrs(n, pp);
+	}
+	if (p > 0.5f) {
+		res = (double)n - res;
+	}
+	return (float)res;
 }
 
 float
@@ -513,46 +643,294 @@ dr_rand_gamma(float k)
 	return gamma_large(k);
 }
 
-float
-dr_rand_poiss(float lambda)
+/* poisson samples */
+/**
+ * Rates below this are sampled by inversion, above by PTRS. */
+#define POISS_PTRS_MIN	10.f
+
+/**
+ * Reciprocals 1/k, for inversion without divisions.
+ * For lambda < 10 the mass beyond k = 63 is below float resolution. */
+static const float poiss_rcp[64U] = {
+	0.f, 1.f, 1.f / 2.f, 1.f / 3.f, 1.f / 4.f, 1.f / 5.f, 1.f / 6.f,
+	1.f / 7.f, 1.f / 8.f, 1.f / 9.f, 1.f / 10.f, 1.f / 11.f, 1.f / 12.f,
+	1.f / 13.f, 1.f / 14.f, 1.f / 15.f, 1.f / 16.f, 1.f / 17.f,
+	1.f / 18.f, 1.f / 19.f, 1.f / 20.f, 1.f / 21.f, 1.f / 22.f,
+	1.f / 23.f, 1.f / 24.f, 1.f / 25.f, 1.f / 26.f, 1.f / 27.f,
+	1.f / 28.f, 1.f / 29.f, 1.f / 30.f, 1.f / 31.f, 1.f / 32.f,
+	1.f / 33.f, 1.f / 34.f, 1.f / 35.f, 1.f / 36.f, 1.f / 37.f,
+	1.f / 38.f, 1.f / 39.f, 1.f / 40.f, 1.f / 41.f, 1.f / 42.f,
+	1.f / 43.f, 1.f / 44.f, 1.f / 45.f, 1.f / 46.f, 1.f / 47.f,
+	1.f / 48.f, 1.f / 49.f, 1.f / 50.f, 1.f / 51.f, 1.f / 52.f,
+	1.f / 53.f, 1.f / 54.f, 1.f / 55.f, 1.f / 56.f, 1.f / 57.f,
+	1.f / 58.f, 1.f / 59.f, 1.f / 60.f, 1.f / 61.f, 1.f / 62.f,
+	1.f / 63.f,
+};
+
+/**
+ * \private Cumulative distribution table for inversion sampling. */
+struct poiss_cdf_s {
+	size_t z;
+	float F[countof(poiss_rcp)];
+};
+
+/**
+ * \private Constants of the PTRS sampler, depending on lambda only. */
+struct poiss_ptrs_s {
+	double lambda;
+	double loglam;
+	double a;
+	double b;
+	double lainvalpha;
+	double vr;
+};
+
+static float
+poiss_inv_u(float lambda, float u, float e)
 {
-	auto float poiss_rnd_small(float lambda)
-	{
-		const float lexp = exp(-lambda);
-		float p = 1.f;
-		unsigned int k = 0U;
+/* sequential inversion of U, O(lambda) multiplications,
+ * E is expected to be exp(-LAMBDA),
+ * in binary32 F stops rising short of 1 (and U may be 1), the mass
+ * beyond that point goes to the last K that still added to F */
+	float p = e;
+	float F = p;
+	size_t k = 0U;
+
+	while (u > F && k + 1U < countof(poiss_rcp)) {
+		const float Fn = F + (p *= lambda * poiss_rcp[k + 1U]);
+
+		if (!(Fn > F)) {
+			break;
+		}
+		F = Fn;
+		k++;
+	}
+	return (float)k;
+}
+
+static inline float
+poiss_inv(float lambda)
+{
+	return poiss_inv_u(lambda, dr_rand_uni(), exp(-lambda));
+}
+
+static void
+poiss_mkcdf(struct poiss_cdf_s *restrict tgt, float lambda)
+{
+	float p = exp(-lambda);
+	float F = p;
+	size_t k = 0U;
+
+	tgt->F[k] = F;
+	while (++k < countof(tgt->F) && F < 1.f) {
+		const float Fn = F + (p *= lambda * poiss_rcp[k]);
 
-		while ((p *= dr_rand_uni()) > lexp) {
-			k++;
+		if (!(Fn > F)) {
+			/* below float resolution from here on */
+			break;
 		}
-		return (float)k;
+		tgt->F[k] = F = Fn;
 	}
+	tgt->z = k;
+	return;
+}
 
-	auto float poiss_rnd_ad(float lambda)
-	{
-		/* Ahrens/Dieter algo */
-		const float m = floor(7.f / 8.f * lambda);
-		const float x = dr_rand_gamma(m);
-
-		if (LIKELY(x <= lambda)) {
-			return m + dr_rand_poiss(lambda - x);
-		} else if ((unsigned int)m - 1U < 1048576U) {
-			return dr_rand_binom((unsigned int)m - 1U, lambda / x);
+static float
+poiss_cdf(const struct poiss_cdf_s *cdf)
+{
+/* inversion by table lookup, one uniform, no transcendentals,
+ * U beyond the last entry (which may be short of 1) maps to it */
+	const float u = dr_rand_uni();
+	size_t k = 0U;
+
+	while (u > cdf->F[k] && k + 1U < cdf->z) {
+		k++;
+	}
+	return (float)k;
+}
+
+static void
+poiss_mkptrs(struct poiss_ptrs_s *restrict tgt, float lambda)
+{
+	const double slam = sqrt((double)lambda);
+
+	tgt->lambda = lambda;
+	tgt->loglam = log((double)lambda);
+	tgt->b = 0.931 + 2.53 * slam;
+	tgt->a = -0.059 + 0.02483 * tgt->b;
+	tgt->lainvalpha = log(1.1239 + 1.1328 / (tgt->b - 3.4));
+	tgt->vr = 0.9277 - 3.6224 / (tgt->b - 2.);
+	return;
+}
+
+static float
+poiss_ptrs(const struct poiss_ptrs_s *c)
+{
+/* Hoermann, "The transformed rejection method for generating Poisson
+ * random variables", Insurance: Mathematics and Economics 12 (1993)
+ * expected number of uniforms is bounded independently of lambda */
+	while (1) {
+		const double U = dr_rand_uni() - 0.5;
+		const double V = dr_rand_uni();
+		const double us = 0.5 - fabs(U);
+		double k;
+
+		if (UNLIKELY(us <= 0.)) {
+			continue;
+		}
+		k = floor((2. * c->a / us + c->b) * U + c->lambda + 0.43);
+		if (us >= 0.07 && V <= c->vr) {
+			return (float)k;
+		} else if (k < 0. || (us < 0.013 && V > us)) {
+			continue;
+		}
+		/* the expensive squeeze */
+		with (double lhs = log(V) + c->lainvalpha -
+		      log(c->a / (us * us) + c->b),
+		      rhs = -c->lambda + k * c->loglam - lgamma(k + 1.)) {
+			if (lhs <= rhs) {
+				return (float)k;
+			}
 		}
-		return m;
 	}
+}
+
+float
+dr_rand_poiss(float lambda)
+{
+	struct poiss_ptrs_s c;
 
 	if (UNLIKELY(lambda < 0.f)) {
 		return NAN;
 	} else if (UNLIKELY(isinf(lambda))) {
 		return INFINITY;
-	} else if (LIKELY(lambda < 15.f)) {
-		return poiss_rnd_small(lambda);
+	} else if (LIKELY(lambda < POISS_PTRS_MIN)) {
+		return poiss_inv(lambda);
 	}
-	return poiss_rnd_ad(lambda);
+	/* PTRS it is */
+	poiss_mkptrs(&c, lambda);
+	return poiss_ptrs(&c);
 }
 
-
+void
+dr_rand_poiss_n(float *restrict tgt, size_t n, float lambda)
+{
+/* sample N times from the same distribution, set up constants once */
+	if (UNLIKELY(lambda < 0.f || isinf(lambda))) {
+		const float x = dr_rand_poiss(lambda);
+
+		for (size_t i = 0; i < n; i++) {
+			tgt[i] = x;
+		}
+	} else if (LIKELY(lambda < POISS_PTRS_MIN)) {
+		struct poiss_cdf_s cdf;
+
+		poiss_mkcdf(&cdf, lambda);
+		for (size_t i = 0; i < n; i++) {
+			tgt[i] = poiss_cdf(&cdf);
+		}
+	} else {
+		struct poiss_ptrs_s c;
+
+		poiss_mkptrs(&c, lambda);
+		for (size_t i = 0; i < n; i++) {
+			tgt[i] = poiss_ptrs(&c);
+		}
+	}
+	return;
+}
+
+void
+dr_rand_poiss_v(float *tgt, const float *lambda, size_t n)
+{
+/* sample once from each of the N distributions in LAMBDA,
+ * TGT and LAMBDA may coincide */
+	for (size_t i = 0; i < n; i++) {
+		const float l = lambda[i];
+
+		if (LIKELY(l >= 0.f && l < POISS_PTRS_MIN)) {
+			tgt[i] = poiss_inv(l);
+		} else {
+			tgt[i] = dr_rand_poiss(l);
+		}
+	}
+	return;
+}
+
+size_t
+dr_rand_poiss_sp(
+	size_t *restrict idx, float *restrict val,
+	const float *lambda, size_t n, float thresh)
+{
+/* Units with rates above THRESH are hot and sampled one by one.
+ * The cold ones all have P(X > 0) <= q = 1 - exp(-THRESH), so we
+ * walk them as Bernoulli(q) trials, jumping geometrically from one
+ * success to the next, and thin each success down to the unit's own
+ * P(X > 0) = 1 - exp(-lambda).  The count is then drawn from the
+ * zero-truncated distribution. */
+	size_t nz = 0U;
+	size_t c;
+	float q;
+
+	auto size_t skip(void)
+	{
+		/* number of failures before the next success */
+		float u;
+		float g;
+
+		while (UNLIKELY((u = dr_rand_uni()) <= 0.f));
+		g = -log(u) / thresh;
+		return LIKELY(g < (float)n) ? (size_t)g : n;
+	}
+
+	if (UNLIKELY(!(thresh > 0.f))) {
+		/* no cold units then */
+		c = n;
+	} else if (UNLIKELY(thresh >= POISS_PTRS_MIN)) {
+		/* keep the truncated inversion below cheap */
+		thresh = POISS_PTRS_MIN;
+		c = skip();
+	} else {
+		c = skip();
+	}
+	/* success rate of the walk, with THRESH as clamped above */
+	q = -expm1(-thresh);
+	for (size_t i = 0; i < n; i++) {
+		const float l = lambda[i];
+		float x;
+
+		if (l > thresh) {
+			/* hot unit, a landing here is void */
+			if (UNLIKELY(i >= c)) {
+				c = i + 1U + skip();
+			}
+			if (!((x = dr_rand_poiss(l)) > 0.f)) {
+				continue;
+			}
+		} else if (LIKELY(i < c)) {
+			continue;
+		} else {
+			/* cold unit landed on, thin and truncate */
+			const float e = exp(-l);
+			const float p = 1.f - e;
+
+			c = i + 1U + skip();
+			if (!(p > 0.f) || dr_rand_uni() * q >= p) {
+				continue;
+			}
+			x = poiss_inv_u(l, e + dr_rand_uni() * p, e);
+			if (UNLIKELY(x < 1.f)) {
+				x = 1.f;
+			}
+		}
+		idx[nz] = i;
+		val[nz] = x;
+		nz++;
+	}
+	return nz;
+}
+
+
 /* initialisers */
 void
 init_rand(void)
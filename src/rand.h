@@ -35,6 +35,8 @@
 #if !defined INCLUDED_rand_h_
 #define INCLUDED_rand_h_
 
+#include <stddef.h>
+
 /* uniform stuff */
 /**
  * Return a random signed char, uniformly distributed. */
@@ -51,11 +53,20 @@ extern long int dr_rand_long(void);
 /**
  * Return a uniformly distributed random float in [0,1]. */
 extern float dr_rand_uni(void);
+/**
+ * Fill TGT with N uniformly distributed random floats in [0,1]. */
+extern void dr_rand_uni_n(float *tgt, size_t n);
+/**
+ * Fill TGT with N random ints, uniformly distributed. */
+extern void dr_rand_int_n(unsigned int *tgt, size_t n);
 
 /**
  * Return a sample drawn from a unit gaussian distribution. */
 /* defined in rand-ziggurat.c */
 extern float dr_rand_norm(void);
+/**
+ * Fill TGT with N samples drawn from a unit gaussian distribution. */
+extern void dr_rand_norm_n(float *tgt, size_t n);
 /**
  * Return a gaussian sample, centred at MU and with variance SIGMA. */
 extern float dr_rand_gauss(float mu, float sigma);
@@ -65,7 +76,8 @@ extern float dr_rand_gauss(float mu, float sigma);
 extern float dr_rand_binom1(float p);
 
 /**
- * Return a binomial sample meeting expectation P. */
+ * Return the number of successes in N trials with success probability P.
+ * Expected cost is constant in N. */
 extern float dr_rand_binom(unsigned int n, float p);
 
 /**
@@ -76,6 +88,28 @@ extern float dr_rand_gamma(float k);
  * Return a sample from the Poisson distribution of shape LAMBDA. */
 extern float dr_rand_poiss(float lambda);
 
+/**
+ * Fill TGT with N samples from the Poisson distribution of shape LAMBDA.
+ * Distribution constants are computed once for all N samples. */
+extern void dr_rand_poiss_n(float *restrict tgt, size_t n, float lambda);
+
+/**
+ * Fill TGT with one sample from each of the N Poisson distributions
+ * of shapes LAMBDA[i].  TGT and LAMBDA may be the same vector. */
+extern void dr_rand_poiss_v(float *tgt, const float *lambda, size_t n);
+
+/**
+ * Like dr_rand_poiss_v() but store only the non-zero samples, as
+ * index IDX[k] and value VAL[k], both of which must hold N entries.
+ * Rates above THRESH are sampled individually, the remaining units are
+ * skipped over geometrically, so that the random work is proportional
+ * to the number of non-zero draws rather than to N.
+ * Return the number of non-zero samples. */
+extern size_t
+dr_rand_poiss_sp(
+	size_t *restrict idx, float *restrict val,
+	const float *lambda, size_t n, float thresh);
+
 /* initialiser */
 /**
  * Initialise the rand subsystem, used for various kinds of randomness. */
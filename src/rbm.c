@@ -36,24 +36,46 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <tgmath.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <assert.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <pthread.h>
+#include <endian.h>
 #include "maths.h"
 #include "rand.h"
+#include "rand-pool.h"
+#include "rand-taus.h"
 #include "nifty.h"
+#include "rbm.h"
 
 /* blas */
 #if defined USE_BLAS
 # include <mkl_cblas.h>
 #endif	/* USE_BLAS */
+#if defined __AVXVNNI__ || defined __AVX512VNNI__ && defined __AVX512VL__
+# define Q8_VNNI
+#endif	/* __AVXVNNI__ || __AVX512VNNI__ && __AVX512VL__ */
+#if defined __F16C__ || defined Q8_VNNI || defined __AVX512VPOPCNTDQ__
+# include <immintrin.h>
+#elif defined __SSE2__
+# include <emmintrin.h>
+#endif	/* __F16C__ || Q8_VNNI || __AVX512VPOPCNTDQ__ */
 
 #define DEFER_UPDATES
 
@@ -67,6 +89,12 @@
 # define auto		static
 #endif	/* __INTEL_COMPILER */
 
+#if defined LIBRBM
+/* the library only propagates, training and upkeep are rbm(1)'s job */
+# pragma GCC diagnostic ignored "-Wunused-function"
+# pragma GCC diagnostic ignored "-Wunused-const-variable"
+#endif	/* LIBRBM */
+
 #define PI		3.141592654f
 #define E		2.718281828f
 
@@ -97,7 +125,7 @@ sse_sdot(const MKL_INT N, const float *X, const float *Y)
 		float f[4U];
 	} sum = {};
 
-	for (MKL_INT i = 0; i < N / 4U; i++, X++, Y++) {
+	for (MKL_INT i = 0; i < N / 4U; i++, X4++, Y4++) {
 		sum.v += *X4 * *Y4;
 	}
 	return sum.f[0U] + sum.f[1U] + sum.f[2U] + sum.f[3U];
@@ -122,21 +150,414 @@ drb_sdot11(const MKL_INT N, const float *X, const float *Y)
 	return sum;
 }
 
-static ni float*
-tr(const float *w, const MKL_INT m, const MKL_INT n)
+/* weight elements, stored as binary32, bfloat16 or binary16,
+ * arithmetic is always done in binary32 */
+typedef enum {
+	DL_ET_UNK,
+	/* ieee754 binary32 */
+	DL_ET_F32,
+	/* bfloat16, the upper half of a binary32 */
+	DL_ET_BF16,
+	/* ieee754 binary16 */
+	DL_ET_F16,
+	DL_NETS,
+} dl_etype_t;
+
+typedef uint16_t h16_t;
+
+/* rounding word for el_st() and friends that rounds to nearest */
+#define EL_RN		0x80000000U
+
+/* lanes for the widening kernels, one sse register of floats */
+#define EL_VZ		4U
+typedef float el_vf_t __attribute__((vector_size(EL_VZ * sizeof(float))));
+typedef uint32_t el_vu_t __attribute__((vector_size(EL_VZ * sizeof(uint32_t))));
+typedef uint16_t el_vh_t __attribute__((vector_size(EL_VZ * sizeof(h16_t))));
+
+static inline size_t
+el_size(dl_etype_t et)
+{
+	switch (et) {
+	case DL_ET_BF16:
+	case DL_ET_F16:
+		return sizeof(h16_t);
+	default:
+		break;
+	}
+	return sizeof(float);
+}
+
+static inline float
+bf16_f32(h16_t x)
+{
+	union {
+		uint32_t u;
+		float f;
+	} r = {.u = (uint32_t)x << 16U};
+	return r.f;
+}
+
+static inline float
+f16_f32(h16_t x)
+{
+/* widen binary16 X, the exponent is rebiased in the integer domain,
+ * subnormals (which most small weights are) go through an exact int
+ * conversion, scaling denormal floats instead is dog slow */
+	const uint32_t s = (uint32_t)(x & 0x8000U) << 16U;
+	const uint32_t u = x & 0x7fffU;
+	union {
+		uint32_t u;
+		float f;
+	} r = {.u = (u << 13U) + 0x38000000U};
+
+	if (UNLIKELY(u < 0x400U)) {
+		r.f = (float)u * 0x1p-24f;
+	} else if (UNLIKELY(u >= 0x7c00U)) {
+		/* inf or nan */
+		r.u = 0x7f800000U | (u & 0x3ffU) << 13U;
+	}
+	r.u |= s;
+	return r.f;
+}
+
+static inline h16_t
+f32_bf16(float x, uint32_t rnd)
+{
+/* narrow X to bfloat16, the upper bits of RND are added below the last
+ * kept digit before truncating, so a uniform RND rounds stochastically
+ * and EL_RN rounds to nearest */
+	union {
+		float f;
+		uint32_t u;
+	} r = {.f = x};
+
+	if (UNLIKELY((r.u & 0x7f800000U) == 0x7f800000U)) {
+		/* inf or nan, keep nans nans */
+		return (h16_t)(r.u >> 16U) | ((r.u & 0x7fffffU) ? 0x40U : 0U);
+	}
+	return (h16_t)((r.u + (rnd >> 16U)) >> 16U);
+}
+
+static inline h16_t
+f32_f16(float x, uint32_t rnd)
+{
+/* narrow X to binary16, RND as with f32_bf16() */
+	union {
+		float f;
+		uint32_t u;
+	} r = {.f = x};
+	const h16_t s = (h16_t)((r.u >> 16U) & 0x8000U);
+	const uint32_t a = r.u & 0x7fffffffU;
+	uint32_t h;
+
+	if (UNLIKELY(a > 0x7f800000U)) {
+		/* nan */
+		return s | 0x7e00U;
+	} else if (a < 0x38800000U) {
+		/* subnormal in binary16, quantum is 2^-24 */
+		r.f = fabsf(x) * 0x1p24f + (float)(rnd >> 8U) * 0x1p-24f;
+		return s | (h16_t)r.f;
+	}
+	/* rebias the exponent, round, and saturate to inf */
+	h = (a - 0x38000000U + (rnd >> 19U)) >> 13U;
+	return s | (h16_t)(h < 0x7c00U ? h : 0x7c00U);
+}
+
+static inline float
+el_ld(const void *w, size_t i, dl_etype_t et)
+{
+/* return element I of W */
+	switch (et) {
+	case DL_ET_BF16:
+		return bf16_f32(((const h16_t*)w)[i]);
+	case DL_ET_F16:
+		return f16_f32(((const h16_t*)w)[i]);
+	default:
+		break;
+	}
+	return ((const float*)w)[i];
+}
+
+static inline void
+el_st(void *w, size_t i, dl_etype_t et, float x, uint32_t rnd)
+{
+/* set element I of W to X, rounded as per RND, see f32_bf16() */
+	switch (et) {
+	case DL_ET_BF16:
+		((h16_t*)w)[i] = f32_bf16(x, rnd);
+		break;
+	case DL_ET_F16:
+		((h16_t*)w)[i] = f32_f16(x, rnd);
+		break;
+	default:
+		((float*)w)[i] = x;
+		break;
+	}
+	return;
+}
+
+static void
+el_ld_row(float *restrict tgt, const void *w, dl_etype_t et, size_t n)
+{
+	if (et == DL_ET_F32) {
+		memcpy(tgt, w, n * sizeof(*tgt));
+		return;
+	}
+	for (size_t j = 0; j < n; j++) {
+		tgt[j] = el_ld(w, j, et);
+	}
+	return;
+}
+
+static void
+el_st_row(void *restrict w, dl_etype_t et, const float *x, size_t n)
+{
+/* store N floats X into W rounding to nearest */
+	if (et == DL_ET_F32) {
+		memcpy(w, x, n * sizeof(*x));
+		return;
+	}
+	for (size_t j = 0; j < n; j++) {
+		el_st(w, j, et, x[j], EL_RN);
+	}
+	return;
+}
+
+static inline el_vf_t
+bf16_v(const h16_t *p)
+{
+	el_vh_t h;
+
+	memcpy(&h, p, sizeof(h));
+	return (el_vf_t)(__builtin_convertvector(h, el_vu_t) << 16U);
+}
+
+static inline el_vf_t
+f16_v(const h16_t *p)
+{
+#if defined __F16C__
+	return (el_vf_t)_mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)p));
+#else  /* !__F16C__ */
+	/* like f16_f32() but branch-free, subnormals are given the
+	 * smallest normal exponent and then have its implicit 1 taken
+	 * off again, that subtraction is exact */
+	el_vh_t h;
+	el_vu_t u, s, r, sub;
+
+	memcpy(&h, p, sizeof(h));
+	u = __builtin_convertvector(h, el_vu_t);
+	s = (u & 0x8000U) << 16U;
+	u &= 0x7fffU;
+	sub = (el_vu_t)(u < 0x400U);
+	r = (u << 13U) + 0x38000000U;
+	r += 0x38000000U & (el_vu_t)(u >= 0x7c00U);
+	r += 0x00800000U & sub;
+	r = (el_vu_t)((el_vf_t)r - (el_vf_t)(0x38800000U & sub));
+	return (el_vf_t)(r | s);
+#endif	/* __F16C__ */
+}
+
+static inline float
+hsum_v(el_vf_t v)
+{
+	float sum = 0.f;
+
+	for (size_t k = 0; k < EL_VZ; k++) {
+		sum += v[k];
+	}
+	return sum;
+}
+
+static ni float
+bf16_sdot(const MKL_INT N, const h16_t *X, const float *Y)
+{
+	el_vf_t acc = {};
+	MKL_INT i = 0;
+	float sum;
+
+	for (; i + (MKL_INT)EL_VZ <= N; i += EL_VZ) {
+		el_vf_t y;
+
+		memcpy(&y, Y + i, sizeof(y));
+		acc += bf16_v(X + i) * y;
+	}
+	for (sum = hsum_v(acc); i < N; i++) {
+		sum += bf16_f32(X[i]) * Y[i];
+	}
+	return sum;
+}
+
+static ni float
+f16_sdot(const MKL_INT N, const h16_t *X, const float *Y)
+{
+	el_vf_t acc = {};
+	MKL_INT i = 0;
+	float sum;
+
+	for (; i + (MKL_INT)EL_VZ <= N; i += EL_VZ) {
+		el_vf_t y;
+
+		memcpy(&y, Y + i, sizeof(y));
+		acc += f16_v(X + i) * y;
+	}
+	for (sum = hsum_v(acc); i < N; i++) {
+		sum += f16_f32(X[i]) * Y[i];
+	}
+	return sum;
+}
+
+static inline float
+el_sdot(const MKL_INT N, const void *X, dl_etype_t et, const float *Y)
 {
-	float *res = malloc(m * n * sizeof(*res));
+/* like drb_sdot11() for X with elements of type ET */
+	switch (et) {
+	case DL_ET_BF16:
+		return bf16_sdot(N, X, Y);
+	case DL_ET_F16:
+		return f16_sdot(N, X, Y);
+	default:
+		break;
+	}
+	return drb_sdot11(N, X, Y);
+}
 
-#define wtr(i, j)	res[i * m + j]
-#define w(i, j)		w[i * n + j]
-	for (MKL_INT i = 0; i < m; i++) {
-		for (MKL_INT j = 0; j < n; j++) {
-			wtr(j, i) = w(i, j);
+static ni void
+el_saxpy(
+	const MKL_INT N, float a, const void *X, dl_etype_t et,
+	float *restrict Y)
+{
+/* Y += a * X for X with elements of type ET */
+	const el_vf_t av = (el_vf_t){} + a;
+	MKL_INT i = 0;
+
+	switch (et) {
+	case DL_ET_BF16:
+		for (; i + (MKL_INT)EL_VZ <= N; i += EL_VZ) {
+			el_vf_t y;
+
+			memcpy(&y, Y + i, sizeof(y));
+			y += av * bf16_v((const h16_t*)X + i);
+			memcpy(Y + i, &y, sizeof(y));
 		}
+		break;
+	case DL_ET_F16:
+		for (; i + (MKL_INT)EL_VZ <= N; i += EL_VZ) {
+			el_vf_t y;
+
+			memcpy(&y, Y + i, sizeof(y));
+			y += av * f16_v((const h16_t*)X + i);
+			memcpy(Y + i, &y, sizeof(y));
+		}
+		break;
+	default:
+		for (const float *x = X; i < N; i++) {
+			Y[i] += a * x[i];
+		}
+		break;
 	}
-#undef w
-#undef wtr
-	return res;
+	for (; i < N; i++) {
+		Y[i] += a * el_ld(X, i, et);
+	}
+	return;
+}
+
+static ni void
+el_sadd_sr(
+	const MKL_INT N, void *restrict X, dl_etype_t et,
+	const float *D, const unsigned int *rnd)
+{
+/* X += D for X with elements of type ET, narrowing rounds
+ * stochastically using the uniform words in RND */
+	if (et == DL_ET_F32) {
+		float *restrict x = X;
+
+		for (MKL_INT i = 0; i < N; i++) {
+			x[i] += D[i];
+		}
+		return;
+	}
+	for (MKL_INT i = 0; i < N; i++) {
+		el_st(X, i, et, el_ld(X, i, et) + D[i], rnd[i]);
+	}
+	return;
+}
+
+static ni int32_t
+q8_sdot(const MKL_INT N, const int8_t *Q, const uint8_t *U)
+{
+/* dot product of int8 weights Q with uint8 inputs U, exact in int32 for
+ * less than 2^16 non-zero inputs, vpdpbusd takes the products four
+ * at a time where available, pmaddubsw would saturate (2 * 255 * 127)
+ * so otherwise both are widened to 16 bits for pmaddwd */
+	int32_t sum = 0;
+	MKL_INT i = 0;
+
+#if defined Q8_VNNI
+	with (__m256i acc = _mm256_setzero_si256()) {
+		typedef int32_t v8si_t __attribute__((vector_size(32U)));
+
+		for (; i + 32 <= N; i += 32) {
+			const __m256i u = _mm256_loadu_si256((const void*)(U + i));
+			const __m256i q = _mm256_loadu_si256((const void*)(Q + i));
+# if defined __AVXVNNI__
+			acc = _mm256_dpbusd_avx_epi32(acc, u, q);
+# else	/* !__AVXVNNI__ */
+			acc = _mm256_dpbusd_epi32(acc, u, q);
+# endif	/* __AVXVNNI__ */
+		}
+		for (size_t k = 0; k < 8U; k++) {
+			sum += ((v8si_t)acc)[k];
+		}
+	}
+#elif defined __SSE2__
+	with (__m128i acc = _mm_setzero_si128()) {
+		typedef int32_t v4si_t __attribute__((vector_size(16U)));
+		const __m128i z = _mm_setzero_si128();
+
+		for (; i + 16 <= N; i += 16) {
+			const __m128i u = _mm_loadu_si128((const void*)(U + i));
+			const __m128i q = _mm_loadu_si128((const void*)(Q + i));
+			/* zero-extend u, sign-extend q */
+			const __m128i ul = _mm_unpacklo_epi8(u, z);
+			const __m128i uh = _mm_unpackhi_epi8(u, z);
+			const __m128i ql = _mm_srai_epi16(_mm_unpacklo_epi8(q, q), 8);
+			const __m128i qh = _mm_srai_epi16(_mm_unpackhi_epi8(q, q), 8);
+
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(ul, ql));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(uh, qh));
+		}
+		for (size_t k = 0; k < 4U; k++) {
+			sum += ((v4si_t)acc)[k];
+		}
+	}
+#endif	/* Q8_VNNI */
+	for (; i < N; i++) {
+		sum += (int32_t)Q[i] * (int32_t)U[i];
+	}
+	return sum;
+}
+
+static ni void
+tr_into(
+	void *restrict res, const size_t ldr,
+	const void *w, const size_t ldw, const MKL_INT m, const MKL_INT n,
+	const size_t ez)
+{
+/* transpose the MxN matrix W (row stride LDW) into RES (row stride LDR),
+ * elements are EZ bytes wide */
+#define TR(T)								\
+	for (MKL_INT i = 0; i < m; i++) {				\
+		for (MKL_INT j = 0; j < n; j++) {			\
+			((T*)res)[j * ldr + i] = ((const T*)w)[i * ldw + j]; \
+		}							\
+	}
+	if (ez == sizeof(h16_t)) {
+		TR(h16_t);
+	} else {
+		TR(float);
+	}
+#undef TR
+	return;
 }
 
 
@@ -166,26 +587,137 @@ mmap_fd(int fd, size_t fz, int prot, int flags)
 	return (glodf_t){.z = fz, .d = p};
 }
 
+/* size of huge pages as handed out by mmap_big() */
+#define HUGE_PGSZ	(2U << 20U)
+
 static inline int
 munmap_fd(glodf_t map)
 {
-	return munmap(map.d, map.z);
+	if (UNLIKELY(munmap(map.d, map.z) < 0)) {
+		/* huge page maps can only be unmapped in whole pages */
+		const size_t hz =
+			(map.z + (HUGE_PGSZ - 1U)) & ~(size_t)(HUGE_PGSZ - 1U);
+		return munmap(map.d, hz);
+	}
+	return 0;
+}
+
+/* placement of the big anonymous buffers, i.e. machines read in-core,
+ * transposes on the heap and the weight deltas of train */
+typedef enum {
+	/* transparent huge pages if the kernel hands them out */
+	MEM_THP = 0U,
+	/* pages from the reserved huge page pool, thp if it's empty */
+	MEM_HUGETLB = 1U << 0U,
+} mem_fl_t;
+
+static mem_fl_t mem_fl;
+
+static glodf_t
+mmap_big(size_t z)
+{
+/* return Z bytes of zeroed anonymous memory, placed as per mem_fl */
+	const int pr = PROT_READ | PROT_WRITE;
+	const int fl = MAP_PRIVATE | MAP_ANONYMOUS;
+	glodf_t res = {.z = 0U, .d = NULL};
+
+	/* mmap() won't do empty maps */
+	z += !z;
+#if defined MAP_HUGETLB
+	if (mem_fl & MEM_HUGETLB) {
+		/* the kernel rounds Z up to whole huge pages, we keep
+		 * the size asked for so it can double as file size */
+		res = mmap_fd(-1, z, pr, fl | MAP_HUGETLB);
+	}
+#endif	/* MAP_HUGETLB */
+	if (res.d == NULL && (res = mmap_fd(-1, z, pr, fl)).d != NULL) {
+#if defined MADV_HUGEPAGE
+		(void)madvise(res.d, res.z, MADV_HUGEPAGE);
+#endif	/* MADV_HUGEPAGE */
+	}
+	return res;
+}
+
+#if !defined MPOL_INTERLEAVE
+# define MPOL_INTERLEAVE	3
+#endif	/* !MPOL_INTERLEAVE */
+#if !defined MPOL_F_MEMS_ALLOWED
+# define MPOL_F_MEMS_ALLOWED	(1 << 2)
+#endif	/* !MPOL_F_MEMS_ALLOWED */
+
+static int
+numa_ilv(void)
+{
+/* interleave pages allocated from now on, anonymous or page cache,
+ * over all NUMA nodes we're allowed to use, so no single node's
+ * memory bandwidth is the bottleneck */
+#if defined SYS_get_mempolicy && defined SYS_set_mempolicy
+	/* room for 1024 nodes */
+	unsigned long nodes[1024U / (sizeof(long) * CHAR_BIT)] = {0U};
+	const unsigned long maxn = sizeof(nodes) * CHAR_BIT;
+
+	if (syscall(SYS_get_mempolicy, NULL, nodes, maxn,
+		    NULL, MPOL_F_MEMS_ALLOWED) < 0) {
+		return -1;
+	} else if (syscall(SYS_set_mempolicy, MPOL_INTERLEAVE,
+			   nodes, maxn) < 0) {
+		return -1;
+	}
+	return 0;
+#else  /* !SYS_get_mempolicy || !SYS_set_mempolicy */
+	errno = ENOSYS;
+	return -1;
+#endif	/* SYS_get_mempolicy && SYS_set_mempolicy */
+}
+
+static glodf_t
+ld_fd(int fd, size_t fz)
+{
+/* read FZ bytes of FD into anonymous memory, in one sequential sweep */
+	glodf_t res;
+
+	/* we're going to touch all of it on every batch */
+	if ((res = mmap_big(fz)).d == NULL) {
+		return res;
+	}
+#if defined POSIX_FADV_SEQUENTIAL
+	(void)posix_fadvise(fd, 0, fz, POSIX_FADV_SEQUENTIAL);
+#endif	/* POSIX_FADV_SEQUENTIAL */
+	for (size_t o = 0U; o < fz;) {
+		const ssize_t nrd = pread(fd, (char*)res.d + o, fz - o, o);
+
+		if (UNLIKELY(nrd < 0 && errno == EINTR)) {
+			continue;
+		} else if (UNLIKELY(nrd <= 0)) {
+			munmap_fd(res);
+			return (glodf_t){.z = 0U, .d = NULL};
+		}
+		o += nrd;
+	}
+	return res;
 }
 
 static glodfn_t
-mmap_fn(const char *fn, int flags)
+mmap_fn(const char *fn, int flags, int fl)
 {
-	const int fl = MAP_SHARED;
-	const int pr = PROT_READ | ((flags & O_RDWR) ? PROT_WRITE : 0);
+/* map FN opened with FLAGS, FL is MAP_SHARED or MAP_PRIVATE,
+ * private maps are always writable,
+ * MAP_ANONYMOUS reads FN into anonymous memory instead of mapping it */
+	const int pr = PROT_READ |
+		((flags & O_RDWR) || (fl & MAP_PRIVATE) ? PROT_WRITE : 0);
 	struct stat st;
 	glodfn_t res;
 
 	if ((res.fd = open(fn, flags)) < 0) {
-		;
+		res.fb = (glodf_t){.z = 0U, .d = NULL};
 	} else if (fstat(res.fd, &st) < 0) {
 		res.fb = (glodf_t){.z = 0U, .d = NULL};
 		goto clo;
-	} else if ((res.fb = mmap_fd(res.fd, st.st_size, pr, fl)).d == NULL) {
+	} else if ((fl & MAP_ANONYMOUS) &&
+		   (res.fb = ld_fd(res.fd, st.st_size)).d == NULL) {
+		goto clo;
+	} else if (!(fl & MAP_ANONYMOUS) &&
+		   (res.fb = mmap_fd(res.fd, st.st_size, pr, fl)).d == NULL) {
 	clo:
 		close(res.fd);
 		res.fd = -1;
@@ -207,21 +739,7 @@ munmap_fn(glodfn_t f)
 	return rc;
 }
 
-static glodfn_t
-mremap_fn(glodfn_t f, int nu_flags)
-{
-	const int nu_prot = PROT_READ;
-
-	if (UNLIKELY(f.fb.d == NULL)) {
-		return (glodfn_t){.fd = -1};
-	}
-	/* first munmap the old buffer */
-	munmap_fd(f.fb);
-	f.fb = mmap_fd(f.fd, f.fb.z, nu_prot, nu_flags);
-	return f;
-}
 
-
 /* custom machine */
 typedef struct dl_rbm_s *dl_rbm_t;
 
@@ -230,7 +748,11 @@ struct dl_rbm_s {
 	size_t nhid;
 	float *vbias;
 	float *hbias;
-	float *w;
+	/* weights, elements of type etype */
+	void *w;
+	/* leading dimension (row stride) of w, at least nhid */
+	size_t ldw;
+	dl_etype_t etype;
 
 	void *priv;
 };
@@ -240,1084 +762,5175 @@ struct dl_spec_s {
 	size_t nhid;
 };
 
+/* on-disk format, a header page followed by sections whose offsets
+ * (in bytes, from the beginning of the file) are noted in the header,
+ * each section starts on a page boundary */
+#define DL_MAGIC	"DrB!"
+#define DL_VERSION	1U
+#define DL_ALGN		4096U
+/* capacities are multiples of this many elements (a cache line) */
+#define DL_CAP_ALGN	16U
+
+typedef enum {
+	DL_MT_UNK,
+	/* poisson visible, binary hidden units */
+	DL_MT_POISS_BIN,
+	DL_NMTS,
+} dl_mtype_t;
+
+typedef enum {
+	DL_SECT_VBIAS,
+	DL_SECT_HBIAS,
+	DL_SECT_W,
+	/* optional sections from here on */
+	DL_SECT_WTR,
+	/* int8 copy of the transpose and its per-visible-unit scales */
+	DL_SECT_Q8,
+	DL_SECT_Q8S,
+	DL_NSECTS,
+} dl_sect_t;
+
+typedef enum {
+	DL_FL_NONE = 0U,
+	/* file carries the transpose of W */
+	DL_FL_WTR = 1U << 0U,
+	/* file carries an int8 copy of W's transpose, for prop only,
+	 * anything that changes W drops it */
+	DL_FL_Q8 = 1U << 1U,
+} dl_flags_t;
+
 struct dl_file_s {
 	uint8_t magic[4U];
-	uint8_t flags[4U];
-	struct dl_spec_s sp;
+	uint16_t version;
+	uint8_t etype;
+	uint8_t mtype;
 
-	/* offset to the beginning */
-	size_t off;
-	float data[];
+	uint64_t nvis;
+	uint64_t nhid;
+
+	/* section offsets, 0 for absent sections, room for future ones */
+	uint64_t off[16U];
+
+	/* optional sections present, as per dl_flags_t */
+	uint64_t flags;
+
+	/* capacity, i.e. units the sections have room for,
+	 * W is stored cvis x chid, its transpose (and the int8 copy
+	 * thereof) chid x cvis,
+	 * 0 means no more room than nvis and nhid respectively */
+	uint64_t cvis;
+	uint64_t chid;
 };
 
-struct dl_rbm_priv_s {
-	glodfn_t f;
-	/* transpose of w */
-	float *wtr;
+/* the unversioned format that came before, the magic was never filled
+ * in, vbias, hbias and W (nvis x nhid) follow as binary32 back to back,
+ * OFF floats into DATA, the upgrade command converts these files */
+struct dl_file_v0_s {
+	uint8_t magic[4U];
+	uint8_t flags[4U];
+	uint64_t nvis;
+	uint64_t nhid;
+	uint64_t off;
+	float data[];
 };
 
-static dl_rbm_t
-pump(const char *file, int flags)
-{
-	static struct dl_rbm_s res;
-	static struct dl_rbm_priv_s p[1];
+static const char *const etype_names[DL_NETS] = {
+	[DL_ET_UNK] = "unknown",
+	[DL_ET_F32] = "f32",
+	[DL_ET_BF16] = "bf16",
+	[DL_ET_F16] = "f16",
+};
 
-	if (UNLIKELY((p->f = mmap_fn(file, flags)).fd < 0)) {
-		goto out;
-	} else if (UNLIKELY(p->f.fb.z < sizeof(struct dl_file_s))) {
-		goto out;
-	}
-	with (struct dl_file_s *fl = p->f.fb.d) {
-		float_t *dp = fl->data + fl->off;
+static const char *const mtype_names[DL_NMTS] = {
+	[DL_MT_UNK] = "unknown",
+	[DL_MT_POISS_BIN] = "poiss->binary",
+};
 
-		res.nvis = fl->sp.nvis;
-		res.vbias = dp;
-		dp += fl->sp.nvis;
+struct dl_rbm_priv_s {
+	glodfn_t f;
+	/* transpose of w, either in the file or in hwtr,
+	 * materialised on first use, see wtr_of() */
+	void *wtr;
+	glodf_t hwtr;
+	/* and its leading dimension */
+	size_t ldwtr;
+	/* int8 weights (hidden-major like wtr) and one scale per
+	 * visible unit, if on file */
+	int8_t *q8;
+	float *q8s;
+	size_t ldq8;
+};
 
-		res.nhid = fl->sp.nhid;
-		res.hbias = dp;
-		dp += fl->sp.nhid;
+/* what pump() hands out, public and private bits in one go */
+struct dl_rbm_hdl_s {
+	struct dl_rbm_s pub;
+	struct dl_rbm_priv_s priv;
+};
 
-		res.w = dp;
+static inline size_t
+algn(size_t z)
+{
+	return (z + (DL_ALGN - 1U)) & ~(size_t)(DL_ALGN - 1U);
+}
 
-		p->wtr = tr(res.w, fl->sp.nvis, fl->sp.nhid);
-	}
-	res.priv = p;
-	return &res;
-out:
-	/* and out are we */
-	(void)munmap_fn(p->f);
-	return NULL;
+static inline size_t
+cap_vis(const struct dl_file_s *fl)
+{
+	return fl->cvis ?: fl->nvis;
 }
 
-static int
-dump(dl_rbm_t m)
+static inline size_t
+cap_hid(const struct dl_file_s *fl)
 {
-	struct dl_rbm_priv_s *p = m->priv;
+	return fl->chid ?: fl->nhid;
+}
 
-	if (UNLIKELY(m == NULL)) {
-		return 0;
+static size_t
+grow_cap(size_t cap, size_t n, size_t want)
+{
+/* return the capacity needed for N units (and at least WANT) when CAP
+ * units fit at the moment, CAP is kept if possible */
+	if (n <= cap && want <= cap) {
+		return cap;
+	} else if (n > cap) {
+		/* grow geometrically so a series of small resizes
+		 * doesn't move everything every time */
+		cap += cap / 2U;
+		cap = cap > n ? cap : n;
 	}
-	return munmap_fn(p->f);
+	cap = cap > want ? cap : want;
+	return (cap + (DL_CAP_ALGN - 1U)) & ~(size_t)(DL_CAP_ALGN - 1U);
 }
 
-static int
-resz(dl_rbm_t m, struct dl_spec_s nu)
+static size_t
+sect_size(const struct dl_file_s *fl, dl_sect_t s)
 {
-/* shrink or expand the machine in M according to dimensions in NU */
-	const int pr = PROT_READ | PROT_WRITE;
-	const int fl = MAP_SHARED;
-	struct dl_rbm_priv_s *p = m->priv;
-	glodfn_t ol_f;
-	glodfn_t nu_f;
+/* return the size of section S in bytes, biasses are always binary32,
+ * dimensions come straight from the file so SIZE_MAX on overflow */
 	size_t z;
-	size_t fz;
-	int res = 0;
 
-	/* remap the current guy */
-	ol_f = mremap_fn(p->f, MAP_PRIVATE);
-
-	/* compute new file size */
-	z = nu.nvis + nu.nhid + nu.nvis * nu.nhid;
-	ftruncate(ol_f.fd, fz = z * sizeof(float) + sizeof(struct dl_file_s));
+	switch (s) {
+	case DL_SECT_VBIAS:
+	case DL_SECT_Q8S:
+		if (UNLIKELY(__builtin_mul_overflow(
+				     cap_vis(fl), sizeof(float), &z))) {
+			break;
+		}
+		return z;
+	case DL_SECT_HBIAS:
+		if (UNLIKELY(__builtin_mul_overflow(
+				     cap_hid(fl), sizeof(float), &z))) {
+			break;
+		}
+		return z;
+	case DL_SECT_W:
+	case DL_SECT_WTR:
+	case DL_SECT_Q8:
+		with (size_t ez = s == DL_SECT_Q8
+		      ? sizeof(int8_t) : el_size(fl->etype)) {
+			if (UNLIKELY(__builtin_mul_overflow(
+					     cap_vis(fl), cap_hid(fl), &z) ||
+				     __builtin_mul_overflow(z, ez, &z))) {
+				break;
+			}
+		}
+		return z;
+	default:
+		return 0U;
+	}
+	return SIZE_MAX;
+}
 
-	if (UNLIKELY((nu_f.fb = mmap_fd(ol_f.fd, fz, pr, fl)).d == NULL)) {
-		res = -1;
-		goto out;
+static bool
+sect_present_p(const struct dl_file_s *fl, dl_sect_t s)
+{
+	switch (s) {
+	case DL_SECT_WTR:
+		return (fl->flags & DL_FL_WTR) != 0U;
+	case DL_SECT_Q8:
+	case DL_SECT_Q8S:
+		return (fl->flags & DL_FL_Q8) != 0U;
+	default:
+		break;
 	}
-	nu_f.fd = ol_f.fd;
+	return true;
+}
 
-	/* just copy the file header over */
-	with (struct dl_file_s *fp = nu_f.fb.d, *op = ol_f.fb.d) {
-		const float vnois = .1f;
-		const float hnois = .01f;
-		const float wnois = 1.f / (nu.nvis * nu.nhid);
-		/* sp is our source pointer (in the private map) */
-		const float_t *sp = op->data + op->off;
-		/* dp is our target pointer in the truncated file */
-		float_t *restrict dp = fp->data + fp->off;
-
-		/* vbiasses */
-		memcpy(m->vbias = dp, sp, op->sp.nvis * sizeof(*sp));
-		dp += m->nvis = nu.nvis;
-		sp += op->sp.nvis;
-		/* wobble */
-		for (size_t i = op->sp.nvis; i < m->nvis; i++) {
-			const float x = dr_rand_uni();
-			m->vbias[i] = log(vnois * x);
-		}
+static size_t
+mk_layout(struct dl_file_s *restrict fl)
+{
+/* lay out sections as per FL's dimensions, return the file size,
+ * or SIZE_MAX if that doesn't fit into a size_t */
+	size_t z = DL_ALGN;
 
-		/* hbiasses */
-		memcpy(m->hbias = dp, sp, op->sp.nhid * sizeof(*sp));
-		dp += m->nhid = nu.nhid;
-		sp += op->sp.nhid;
-		/* wobble */
-		for (size_t j = op->sp.nhid; j < m->nhid; j++) {
-			const float x = dr_rand_norm();
-			m->hbias[j] = hnois * x;
+	for (dl_sect_t s = DL_SECT_VBIAS; s < DL_NSECTS; s++) {
+		if (!sect_present_p(fl, s)) {
+			fl->off[s] = 0U;
+			continue;
 		}
-
-		/* weight matrix */
-		memcpy(m->w = dp, sp, op->sp.nvis * op->sp.nhid * sizeof(*sp));
-		/* wobble */
-		for (size_t k = op->sp.nvis * op->sp.nhid;
-		     k < m->nvis * m->nhid; k++) {
-			const float x = dr_rand_norm();
-			m->w[k] = wnois * x;
+		fl->off[s] = z;
+		if (UNLIKELY(__builtin_add_overflow(z, sect_size(fl, s), &z) ||
+			     z > SIZE_MAX - DL_ALGN)) {
+			return SIZE_MAX;
 		}
+		z = algn(z);
+	}
+	return z;
+}
 
-		/* recalc the transposed of w */
-		free(p->wtr);
-		p->wtr = tr(m->w, nu.nvis, nu.nhid);
-
-		/* assign the new size */
-		fp->sp = nu;
+static int
+chk_hdr(const struct dl_file_s *fl, size_t fz)
+{
+/* check FL against what we understand, FZ is the size of the file */
+	if (UNLIKELY(fz < DL_ALGN)) {
+		return -1;
+	} else if (UNLIKELY(memcmp(fl->magic, DL_MAGIC, sizeof(fl->magic)))) {
+		return -1;
+	} else if (UNLIKELY(fl->version != DL_VERSION)) {
+		return -1;
+	} else if (UNLIKELY(fl->etype == DL_ET_UNK || fl->etype >= DL_NETS)) {
+		return -1;
+	} else if (UNLIKELY(fl->mtype != DL_MT_POISS_BIN)) {
+		return -1;
+	} else if (UNLIKELY(cap_vis(fl) < fl->nvis || cap_hid(fl) < fl->nhid)) {
+		return -1;
 	}
-	p->f = nu_f;
+	for (dl_sect_t s = DL_SECT_VBIAS; s < DL_NSECTS; s++) {
+		const uint64_t o = fl->off[s];
 
-out:
-	munmap_fd(ol_f.fb);
-	return res;
+		if (!sect_present_p(fl, s)) {
+			continue;
+		} else if (UNLIKELY(o % DL_ALGN || o < DL_ALGN)) {
+			return -1;
+		} else if (UNLIKELY(o > fz || sect_size(fl, s) > fz - o)) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
-static dl_rbm_t
-crea(const char *file, struct dl_spec_s sp)
+static const float*
+v0_data(const void *d, size_t fz)
 {
-	static glodfn_t f;
-	const int pr = PROT_READ | PROT_WRITE;
-	const int fl = MAP_SHARED;
-	size_t fz;
-	int fd;
-	dl_rbm_t res;
+/* return the biasses and weights of unversioned machine D of FZ bytes,
+ * NULL if D doesn't look like one */
+	const struct dl_file_v0_s *fl = d;
+	size_t n;
 
-	if (UNLIKELY((fd = open(file, O_CREAT | O_RDWR | O_TRUNC, 0666)) < 0)) {
+	if (fz < sizeof(*fl)) {
+		return NULL;
+	} else if (!memcmp(fl->magic, DL_MAGIC, sizeof(fl->magic))) {
+		return NULL;
+	} else if (!fl->nvis || !fl->nhid) {
+		return NULL;
+	} else if (__builtin_mul_overflow(fl->nvis, fl->nhid, &n) ||
+		   __builtin_add_overflow(n, fl->nvis, &n) ||
+		   __builtin_add_overflow(n, fl->nhid, &n) ||
+		   __builtin_add_overflow(n, fl->off, &n) ||
+		   n > (fz - sizeof(*fl)) / sizeof(*fl->data)) {
 		return NULL;
 	}
-	/* compute total file size */
-	ftruncate(fd, fz = sizeof(struct dl_file_s));
+	return fl->data + fl->off;
+}
+
+static int
+peek(struct dl_file_s *restrict tgt, const char *file)
+{
+/* read and check just the header of machine file FILE into TGT */
+	struct stat st;
+	ssize_t nrd;
+	int fd;
 
-	if (UNLIKELY((f.fb = mmap_fd(f.fd = fd, fz, pr, fl)).d == NULL)) {
+	if (UNLIKELY((fd = open(file, O_RDONLY)) < 0)) {
+		return -1;
+	} else if (UNLIKELY(fstat(fd, &st) < 0)) {
 		goto out;
-	}
-	/* normally we'd fill in titbits like our magic string and flags */
-	;
-	munmap_fn(f);
-
-	/* now let pump() and resz() do the rest */
-	if ((res = pump(file, O_RDWR)) == NULL) {
-		/* nawww */
+	} else if ((nrd = pread(fd, tgt, sizeof(*tgt), 0)) < (ssize_t)sizeof(*tgt)) {
 		goto out;
-	} else if (resz(res, sp) < 0) {
-		/* shame */
+	} else if (UNLIKELY(chk_hdr(tgt, st.st_size) < 0)) {
 		goto out;
 	}
-	/* all's good */
-	return res;
-
+	close(fd);
+	return 0;
 out:
 	close(fd);
-	return NULL;
+	return -1;
 }
 
-
-/* sparse integer vectors */
-typedef struct spsc_s spsc_t;
-typedef struct spsv_s spsv_t;
+/* row journal, instead of rewriting the machine file checkpoints may
+ * append frames to FILE.jnl, each frame holds the biasses and those rows
+ * of W that changed since the previous frame, verbatim (not as deltas)
+ * so replaying a journal twice does no harm */
+#define DL_JNL_MAGIC	"DrBj"
+#define DL_JNL_EMAGIC	"DrBjEnd"
+#define DL_JNL_SFX	".jnl"
 
-struct spsc_s {
-	size_t i;
-	uint8_t v;
+struct dl_jnl_s {
+	uint8_t magic[4U];
+	/* element type of the rows */
+	uint8_t etype;
+	uint8_t pad[3U];
+
+	uint64_t nvis;
+	uint64_t nhid;
+	/* number of rows in this frame */
+	uint64_t nrow;
+	/* followed by vbias[nvis], hbias[nhid],
+	 * then nrow times row index (uint64_t) and w[i, 0..nhid] (as etype),
+	 * then the trailer below */
 };
 
-struct spsv_s {
-	size_t z;
-	spsc_t *v;
+/* frames end in this so torn frames can be told apart */
+struct dl_jnl_end_s {
+	/* size of the whole frame, trailer included */
+	uint64_t z;
+	uint8_t magic[8U];
 };
 
-static spsv_t
-read_tf(const int fd)
+/* number of words in a row bitmap for N rows */
+#define DRT_NW(n)	(((n) + 63U) / 64U)
+
+static size_t
+jnl_frmz(size_t nv, size_t nh, size_t nrow, size_t ez)
 {
-	static char *line;
-	static size_t llen;
-	static struct spsc_s *spsv;
-	static size_t spsz;
-	ssize_t nrd;
-	size_t i = 0U;
+/* return the size of a frame of NROW rows with EZ-byte elements */
+	return sizeof(struct dl_jnl_s) + (nv + nh) * sizeof(float) +
+		nrow * (sizeof(uint64_t) + nh * ez) +
+		sizeof(struct dl_jnl_end_s);
+}
 
-	if (UNLIKELY(fd < 0)) {
-		if (line != NULL) {
-			free(line);
-		}
-		if (spsv != NULL) {
-			free(spsv);
-		}
-		return (spsv_t){.z = 0U, .v = NULL};
+static int
+jnl_fn(char *restrict buf, size_t bsz, const char *file)
+{
+	if (UNLIKELY((size_t)snprintf(
+			     buf, bsz, "%s" DL_JNL_SFX, file) >= bsz)) {
+		return -1;
 	}
+	return 0;
+}
 
-	/* now then */
-	while ((nrd = getline(&line, &llen, stdin)) > 0) {
-		char *p;
-		long unsigned int v;
-		long unsigned int c;
-
-		/* check for form feeds, and maybe yield */
-		if (*line == '\f') {
-			break;
-		}
-		/* read the term id */
-		v = strtoul(line, &p, 0);
-		if (*p++ != '\t') {
-			continue;
-		}
-		/* read the count */
-		c = strtoul(p, &p, 0);
-		if (*p++ != '\n') {
-			continue;
-		}
+static int
+jnl_rm(const char *file)
+{
+/* get rid of FILE's journal */
+	char jfn[PATH_MAX];
 
-		if (UNLIKELY(i >= spsz)) {
-			/* extend vector */
-			size_t nu = spsz + 256U;
-			spsv = realloc(spsv, nu * sizeof(*spsv));
-			spsz = nu;
-		}
-		/* assign index/value pair */
-		spsv[i].i = v;
-		spsv[i].v = c;
-		i++;
+	if (UNLIKELY(jnl_fn(jfn, sizeof(jfn), file) < 0)) {
+		return -1;
+	} else if (unlink(jfn) < 0 && errno != ENOENT) {
+		return -1;
 	}
-	return (spsv_t){.z = i, .v = spsv};
+	return 0;
 }
 
-static size_t
-popul_sv(float *restrict x, size_t z, const spsv_t sv)
+static bool
+jnl_p(const char *file)
 {
-/* Populate the bottom visible layer X (hopefully large enough)
- * with values from sparse vector SV.
- * Return the total number of words. */
-	size_t res = 0U;
+	char jfn[PATH_MAX];
 
-	memset(x, 0, z * sizeof(*x));
-	for (size_t j = 0; j < sv.z; j++) {
-		size_t i = sv.v[j].i;
-		uint8_t c = sv.v[j].v;
+	return jnl_fn(jfn, sizeof(jfn), file) == 0 && access(jfn, F_OK) == 0;
+}
 
-		if (UNLIKELY(i >= z)) {
+static int
+jnl_lock(const char *file)
+{
+/* open FILE's journal and lock it exclusively, return the descriptor,
+ * appends by jnl_wr() are kept out until it's closed */
+	char jfn[PATH_MAX];
+	int fd;
+
+	if (UNLIKELY(jnl_fn(jfn, sizeof(jfn), file) < 0)) {
+		return -1;
+	} else if ((fd = open(jfn, O_RDWR)) < 0) {
+		return -1;
+	}
+	while (UNLIKELY(flock(fd, LOCK_EX) < 0)) {
+		if (errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+static ssize_t
+jnl_replay(dl_rbm_t m, const char *file, bool fixp)
+{
+/* apply the frames in FILE's journal to M, return the number of frames
+ * applied, frames not matching M's dimensions are an error,
+ * a torn frame ends the replay, it may well be an append in progress,
+ * so it is cut off (making room for later appends) only if FIXP, i.e.
+ * the caller holds the journal's lock, see jnl_lock() */
+	struct dl_rbm_priv_s *p = m->priv;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+	const size_t ez = el_size(m->etype);
+	char jfn[PATH_MAX];
+	glodfn_t j;
+	ssize_t res = 0;
+	size_t o;
+
+	if (UNLIKELY(jnl_fn(jfn, sizeof(jfn), file) < 0)) {
+		return -1;
+	} else if ((j = mmap_fn(jfn, O_RDONLY, MAP_SHARED)).fd < 0) {
+		/* no journal or an empty one, fine */
+		return errno == ENOENT || errno == EINVAL ? 0 : -1;
+	}
+	for (o = 0U; o + sizeof(struct dl_jnl_s) <= j.fb.z;) {
+		const char *jp = (const char*)j.fb.d + o;
+		struct dl_jnl_s hdr;
+		struct dl_jnl_end_s end;
+		size_t fz;
+
+		memcpy(&hdr, jp, sizeof(hdr));
+		if (UNLIKELY(memcmp(hdr.magic, DL_JNL_MAGIC, 4U))) {
+			break;
+		} else if (UNLIKELY(hdr.nvis != nv || hdr.nhid != nh ||
+				    hdr.etype != m->etype)) {
 			fprintf(stderr, "\
-not populating entry %zu, machine's network too small\n", i);
-			continue;
+journal `%s' does not match the dimensions of `%s'\n", jfn, file);
+			res = -1;
+			break;
+		} else if (UNLIKELY(hdr.nrow > nv ||
+				    (fz = jnl_frmz(nv, nh, hdr.nrow, ez)) >
+				    j.fb.z - o)) {
+			/* torn */
+			break;
+		}
+		memcpy(&end, jp + fz - sizeof(end), sizeof(end));
+		if (UNLIKELY(end.z != fz ||
+			     memcmp(end.magic, DL_JNL_EMAGIC, 8U))) {
+			/* torn */
+			break;
 		}
 
-		res += c;
-		x[i] = (float)(int)c;
+		/* all's well, bang it in */
+		jp += sizeof(hdr);
+		memcpy(m->vbias, jp, nv * sizeof(*m->vbias));
+		jp += nv * sizeof(*m->vbias);
+		memcpy(m->hbias, jp, nh * sizeof(*m->hbias));
+		jp += nh * sizeof(*m->hbias);
+		for (size_t k = 0; k < hdr.nrow; k++) {
+			uint64_t i;
+
+			memcpy(&i, jp, sizeof(i));
+			jp += sizeof(i);
+			if (LIKELY(i < nv)) {
+				char *wi = (char*)m->w + i * m->ldw * ez;
+
+				memcpy(wi, jp, nh * ez);
+				if (p->wtr != NULL) {
+					tr_into((char*)p->wtr + i * ez,
+						p->ldwtr, wi, m->ldw, 1, nh, ez);
+				}
+			}
+			jp += nh * ez;
+		}
+		o += fz;
+		res++;
+	}
+	(void)munmap_fn(j);
+	if (fixp && res >= 0 && o < j.fb.z && truncate(jfn, o) < 0) {
+		res = -1;
 	}
 	return res;
 }
 
-
-#if !defined NDEBUG
 static void
-dump_layer(const char *pre, const float *x, size_t z)
+q8_attach(dl_rbm_t m)
 {
-	float minx = INFINITY;
-	float maxx = -INFINITY;
+/* point M at the int8 weights in its file, if any */
+	struct dl_rbm_priv_s *p = m->priv;
+	const struct dl_file_s *fl = p->f.fb.d;
 
-	for (size_t i = 0; i < z; i++) {
-		if (x[i] < minx) {
-			minx = x[i];
-		}
-		if (x[i] > maxx) {
-			maxx = x[i];
-		}
+	p->q8 = NULL;
+	p->q8s = NULL;
+	if (fl->flags & DL_FL_Q8) {
+		char *dp = p->f.fb.d;
+
+		p->q8 = (int8_t*)(dp + fl->off[DL_SECT_Q8]);
+		p->q8s = (float*)(dp + fl->off[DL_SECT_Q8S]);
+		p->ldq8 = cap_vis(fl);
 	}
-	printf("%s (%.6g  %.6g)\n", pre, minx, maxx);
 	return;
 }
 
-static size_t
-count_layer(const float *x, size_t z)
+static inline bool
+q8_p(dl_rbm_t m)
 {
-	size_t sum = 0U;
+/* return whether M comes with int8 weights */
+	return ((const struct dl_rbm_priv_s*)m->priv)->q8 != NULL;
+}
 
-	for (size_t i = 0; i < z; i++) {
-		if (x[i] > 0.f) {
-			sum++;
-		}
+static bool
+q8_drop(dl_rbm_t m)
+{
+/* forget about M's int8 weights, they're about to go stale,
+ * return whether there were any */
+	struct dl_rbm_priv_s *p = m->priv;
+	struct dl_file_s *fl = p->f.fb.d;
+
+	if (!(fl->flags & DL_FL_Q8)) {
+		return false;
 	}
-	return sum;
+	/* the sections stay where they are, quantize picks them up again */
+	fl->flags &= ~(uint64_t)DL_FL_Q8;
+	q8_attach(m);
+	return true;
 }
 
-static float
-integ_layer(const float *x, size_t z)
+static dl_rbm_t
+pump_fl(const char *file, int flags, int mfl)
 {
-	float sum = 0U;
+/* open machine FILE with open(2) FLAGS, map it with mmap(2) flags MFL,
+ * a journal next to FILE is replayed, into the file itself (and then
+ * removed) for writable shared maps, into memory otherwise,
+ * opening FILE for writing makes us a journal writer, those hold the
+ * journal's lock while replaying and repair a torn tail */
+	struct dl_rbm_hdl_s *res;
+	struct dl_rbm_priv_s *p;
+	const bool jnlp = jnl_p(file);
+	int lfd = -1;
+	ssize_t nfrm;
+
+	if (jnlp && mfl == MAP_SHARED && !(flags & O_RDWR)) {
+		/* we need to write the journal somewhere */
+		mfl = MAP_PRIVATE;
+	}
+	if (UNLIKELY((res = calloc(1, sizeof(*res))) == NULL)) {
+		return NULL;
+	}
+	p = &res->priv;
+	if (UNLIKELY((p->f = mmap_fn(file, flags, mfl)).fd < 0)) {
+		goto out;
+	} else if (UNLIKELY(chk_hdr(p->f.fb.d, p->f.fb.z) < 0)) {
+		if (v0_data(p->f.fb.d, p->f.fb.z) != NULL) {
+			fprintf(stderr, "\
+machine file `%s' predates the version %u format, \
+convert it with the upgrade command\n", file, DL_VERSION);
+			goto out;
+		}
+		fprintf(stderr, "\
+machine file `%s' is not of version %u format\n", file, DL_VERSION);
+		goto out;
+	}
+	with (const struct dl_file_s *fl = p->f.fb.d) {
+		char *dp = p->f.fb.d;
+
+		res->pub.nvis = fl->nvis;
+		res->pub.nhid = fl->nhid;
+		res->pub.vbias = (float*)(dp + fl->off[DL_SECT_VBIAS]);
+		res->pub.hbias = (float*)(dp + fl->off[DL_SECT_HBIAS]);
+		res->pub.w = dp + fl->off[DL_SECT_W];
+		res->pub.ldw = cap_hid(fl);
+		res->pub.etype = (dl_etype_t)fl->etype;
+
+		if (fl->flags & DL_FL_WTR) {
+			/* yay, nothing to compute */
+			p->wtr = dp + fl->off[DL_SECT_WTR];
+			p->ldwtr = cap_vis(fl);
+		}
+	}
+	res->pub.priv = p;
+	q8_attach(&res->pub);
 
-	for (size_t i = 0; i < z; i++) {
-		if (x[i] > 0.f) {
-			sum += x[i];
+	if (!jnlp) {
+		;
+	} else if ((flags & O_RDWR) &&
+		   UNLIKELY((lfd = jnl_lock(file)) < 0 && errno != ENOENT)) {
+		fprintf(stderr, "cannot lock journal of `%s'\n", file);
+		goto out;
+	} else if (UNLIKELY((nfrm = jnl_replay(
+				     &res->pub, file, lfd >= 0)) < 0)) {
+		fprintf(stderr, "cannot replay journal of `%s'\n", file);
+		goto out;
+	} else if (nfrm > 0 && q8_drop(&res->pub) && mfl == MAP_SHARED) {
+		fprintf(stderr, "\
+int8 weights of `%s' are stale after replaying its journal, dropped\n", file);
+	}
+	if (jnlp && mfl == MAP_SHARED) {
+		/* folded into the file, make that durable first */
+		if (UNLIKELY(msync(p->f.fb.d, p->f.fb.z, MS_SYNC) < 0 ||
+			     jnl_rm(file) < 0)) {
+			goto out;
 		}
 	}
-	return sum;
+	if (lfd >= 0) {
+		close(lfd);
+	}
+	return &res->pub;
+out:
+	/* and out are we */
+	if (lfd >= 0) {
+		close(lfd);
+	}
+	(void)munmap_fn(p->f);
+	free(res);
+	return NULL;
 }
-#endif	/* !NDEBUG */
-
-
-/* propagation, gibbs sampling and learning */
-/* global parameters */
-#if defined SALAKHUTDINOV
-static size_t N;
-#endif	/* SALAKHUTDINOV */
 
-static ni int
-prop_up(float *restrict h, dl_rbm_t m, const float vis[static m->nvis])
+static inline dl_rbm_t
+pump(const char *file, int flags)
 {
-/* propagate visible units activation upwards to the hidden units (recon) */
-	const size_t nvis = m->nvis;
-	const size_t nhid = m->nhid;
-	const struct dl_rbm_priv_s *p = m->priv;
-	const float *wtr = p->wtr;
-	const float *b = m->hbias;
-
-#define w(j)		(wtr + j * nvis)
-	for (size_t j = 0; j < nhid; j++) {
-		h[j] = b[j] + drb_sdot11(nvis, w(j), vis);
-	}
-#undef w
-	return 0;
+	return pump_fl(file, flags, MAP_SHARED);
 }
 
-static ni int
-expt_hid(float *restrict h, dl_rbm_t m, const float hid[static m->nhid])
+static void*
+wtr_of(dl_rbm_t m)
 {
-	const size_t nhid = m->nhid;
+/* return M's transpose, compute it if it's neither in the file
+ * nor has been asked for before */
+	struct dl_rbm_priv_s *p = m->priv;
 
-	DEBUG(dump_layer("Ha", hid, nhid));
+	if (UNLIKELY(p->wtr == NULL)) {
+		const size_t ez = el_size(m->etype);
 
-	for (size_t j = 0; j < nhid; j++) {
-		h[j] = sigma(hid[j]);
+		p->hwtr = mmap_big(m->nvis * m->nhid * ez);
+		if (UNLIKELY(p->hwtr.d == NULL)) {
+			return NULL;
+		}
+		tr_into(p->hwtr.d, m->nvis,
+			m->w, m->ldw, m->nvis, m->nhid, ez);
+		p->wtr = p->hwtr.d;
+		p->ldwtr = m->nvis;
 	}
-	return 0;
+	return p->wtr;
 }
 
-static ni int
-smpl_hid(float *restrict h, dl_rbm_t m, const float hid[static m->nhid])
+static void
+q8_mk(dl_rbm_t m)
 {
-/* infer hidden unit states given vis(ible units) */
-	const size_t nhid = m->nhid;
+/* quantise M's weights into its int8 sections, one scale per visible
+ * unit so that its largest weight maps to +/-127, weights of frequent
+ * terms are orders of magnitude above the rest, so scales per hidden
+ * unit would leave nothing for the bulk of the terms */
+	const struct dl_rbm_priv_s *p = m->priv;
+	const size_t nh = m->nhid;
+	const dl_etype_t et = m->etype;
+	const size_t ez = el_size(et);
 
-	DEBUG(dump_layer("He", hid, nhid));
+	for (size_t i = 0; i < m->nvis; i++) {
+		const void *wi = (const char*)m->w + i * m->ldw * ez;
+		int8_t *qi = p->q8 + i;
+		float amax = 0.f;
 
-	for (size_t j = 0; j < nhid; j++) {
-		/* just flip a coin */
-		h[j] = dr_rand_binom1(hid[j]);
-	}
+		for (size_t j = 0; j < nh; j++) {
+			const float x = fabsf(el_ld(wi, j, et));
+			amax = x > amax ? x : amax;
+		}
+		p->q8s[i] = amax / 127.f;
+		for (size_t j = 0; j < nh; j++) {
+			const float x = el_ld(wi, j, et);
 
-	DEBUG(dump_layer("Hs", h, nhid));
-	return 0;
+			qi[j * p->ldq8] = (int8_t)
+				(amax > 0.f ? lrintf(x * 127.f / amax) : 0);
+		}
+	}
+	return;
 }
 
-static ni int
-prop_down(float *restrict v, dl_rbm_t m, const float hid[static m->nhid])
+static int
+dump(dl_rbm_t m)
 {
-/* propagate hidden units activation downwards to the visible units */
-	const size_t nvis = m->nvis;
-	const size_t nhid = m->nhid;
-	const float *w = m->w;
-	const float *b = m->vbias;
+	struct dl_rbm_priv_s *p;
+	int res;
 
-#define w(i)		(w + i * nhid)
-	for (size_t i = 0; i < nvis; i++) {
-		v[i] = b[i] + drb_sdot11(nhid, w(i), hid);
+	if (UNLIKELY(m == NULL)) {
+		return 0;
 	}
-#undef w
-	return 0;
+	p = m->priv;
+	if (p->hwtr.d != NULL) {
+		munmap_fd(p->hwtr);
+	}
+	res = munmap_fn(p->f);
+	/* the handle came from pump() */
+	free((struct dl_rbm_hdl_s*)m);
+	return res;
 }
 
-static ni int
-expt_vis(float *restrict v, dl_rbm_t m, const float vis[static m->nvis])
+static dl_rbm_t
+sub_rbm(dl_rbm_t m, const size_t *u, size_t nu)
 {
-	const size_t nvis = m->nvis;
+/* return a machine of M's hidden units U[0, NU) only, for prop, their
+ * biasses and weights are gathered into one block, the transpose comes
+ * straight from w so M's is never needed, M's int8 scales are shared
+ * so M must outlive the result, free it with dump() */
+	const struct dl_rbm_priv_s *p = m->priv;
+	const size_t nv = m->nvis;
+	const dl_etype_t et = m->etype;
+	const size_t ez = el_size(et);
+	const bool q8p = q8_p(m);
+	/* biasses, then int8 weights, or the transpose and w */
+	const size_t zb = algn(nu * sizeof(*m->hbias));
+	const size_t zt = algn(nu * nv * (q8p ? sizeof(*p->q8) : ez));
+	const size_t zw = q8p ? 0U : nv * nu * ez;
+	struct dl_rbm_hdl_s *res;
+	char *d;
+
+	if (UNLIKELY((res = calloc(1U, sizeof(*res))) == NULL)) {
+		return NULL;
+	} else if (UNLIKELY((res->priv.hwtr = mmap_big(zb + zt + zw)).d == NULL)) {
+		free(res);
+		return NULL;
+	}
+	d = res->priv.hwtr.d;
+	res->priv.f = (glodfn_t){.fd = -1};
+	res->pub = (struct dl_rbm_s){
+		.nvis = nv,
+		.nhid = nu,
+		.vbias = m->vbias,
+		.hbias = (float*)d,
+		.etype = et,
+		.priv = &res->priv,
+	};
+
+	for (size_t j = 0U; j < nu; j++) {
+		res->pub.hbias[j] = m->hbias[u[j]];
+	}
+	if (q8p) {
+		int8_t *q = (int8_t*)(d + zb);
 
-	DEBUG(dump_layer("Va", vis, nvis));
+		for (size_t j = 0U; j < nu; j++) {
+			memcpy(q + j * nv, p->q8 + u[j] * p->ldq8, nv);
+		}
+		res->priv.q8 = q;
+		res->priv.q8s = p->q8s;
+		res->priv.ldq8 = nv;
+	} else {
+		char *t = d + zb;
+		char *w = d + zb + zt;
 
-#if defined SALAKHUTDINOV
-	softmax(v, vis, nvis);
-	with (const float scal = (float)N) {
-		for (size_t i = 0; i < nvis; i++) {
-			v[i] *= scal;
+		for (size_t i = 0U; i < nv; i++) {
+			const char *wi = (const char*)m->w + i * m->ldw * ez;
+
+			for (size_t j = 0U; j < nu; j++) {
+				memcpy(w + (i * nu + j) * ez, wi + u[j] * ez, ez);
+				memcpy(t + (j * nv + i) * ez, wi + u[j] * ez, ez);
+			}
 		}
+		res->priv.wtr = t;
+		res->priv.ldwtr = nv;
+		res->pub.w = w;
+		res->pub.ldw = nu;
 	}
-#elif defined GEHLER
-	for (size_t i = 0; i < nvis; i++) {
-		v[i] = exp(vis[i]);
-	}
-#elif defined BINOM_INPUT
-	for (size_t i = 0; i < nvis; i++) {
-		v[i] = sigma(vis[i]);
-	}
-#endif	/* impls */
-	return 0;
+	return &res->pub;
 }
 
-static ni int
-smpl_vis(float *restrict v, dl_rbm_t m, const float vis[static m->nvis])
+static void
+nois(float *restrict x, size_t z, float dev)
 {
-/* infer visible unit states given hid(den units) */
+/* fill X with Z samples of a centred gaussian with deviation DEV */
+	dr_rand_norm_n(x, z);
+	for (size_t i = 0; i < z; i++) {
+		x[i] *= dev;
+	}
+	return;
+}
+
+static void
+tr_box(dl_rbm_t m, size_t i0, size_t i1, size_t j0, size_t j1)
+{
+/* copy cells [I0, I1) x [J0, J1) of M's weights to its mapped transpose */
+	const struct dl_rbm_priv_s *p = m->priv;
+	const size_t ez = el_size(m->etype);
+
+	if (i0 >= i1 || j0 >= j1) {
+		return;
+	}
+	tr_into((char*)p->wtr + (j0 * p->ldwtr + i0) * ez, p->ldwtr,
+		(const char*)m->w + (i0 * m->ldw + j0) * ez, m->ldw,
+		i1 - i0, j1 - j0, ez);
+	return;
+}
+
+static int
+resz(
+	dl_rbm_t m, struct dl_spec_s nu, struct dl_spec_s cap, uint64_t flags,
+	dl_etype_t et)
+{
+/* shrink or expand the machine in M according to dimensions in NU,
+ * reserve room for at least CAP units,
+ * optional sections in FLAGS are added to the ones present already,
+ * weights are converted to element type ET unless that's DL_ET_UNK
+ * as long as NU fits into the reserved room nothing moves, only the
+ * new cells are initialised */
+	const int pr = PROT_READ | PROT_WRITE;
+	const int fl = MAP_SHARED;
+	struct dl_rbm_priv_s *p = m->priv;
+	const struct dl_spec_s ol = {m->nvis, m->nhid};
+	const size_t oldw = m->ldw;
+	const dl_etype_t oet = m->etype;
+	struct dl_file_s hdr = *(const struct dl_file_s*)p->f.fb.d;
+	const uint64_t ofl = hdr.flags;
+	float *ovb = NULL;
+	float *ohb = NULL;
+	float *ow = NULL;
+	float *rw = NULL;
+	bool movp;
+	size_t fz;
+	int res = -1;
+
+	/* compute new capacity, layout and file size */
+	with (size_t cv = cap_vis(&hdr), ch = cap_hid(&hdr)) {
+		hdr.cvis = grow_cap(cv, nu.nvis, cap.nvis);
+		hdr.chid = grow_cap(ch, nu.nhid, cap.nhid);
+		/* sections move iff the capacity or element size changes,
+		 * just move them for any conversion */
+		movp = hdr.cvis != cv || hdr.chid != ch ||
+			(et != DL_ET_UNK && et != oet);
+	}
+	if (et != DL_ET_UNK) {
+		hdr.etype = et;
+	}
+	hdr.nvis = nu.nvis;
+	hdr.nhid = nu.nhid;
+	hdr.flags |= flags;
+	if (UNLIKELY((fz = mk_layout(&hdr)) == SIZE_MAX)) {
+		/* too big for this address space */
+		return -1;
+	}
+
+	/* a transpose on the heap is stale now, wtr_of() recomputes it */
+	if (p->hwtr.d != NULL) {
+		munmap_fd(p->hwtr);
+		p->hwtr = (glodf_t){.z = 0U, .d = NULL};
+	}
+	p->wtr = NULL;
+
+	/* new weights are drawn in binary32 one row at a time */
+	if (UNLIKELY((rw = malloc(nu.nhid * sizeof(*rw) + 1U)) == NULL)) {
+		goto out;
+	}
+	if (movp) {
+		/* sections are about to move, keep a (widened) copy
+		 * of the old ones */
+		const size_t oez = el_size(oet);
+
+		if (UNLIKELY((ovb = malloc(ol.nvis * sizeof(*ovb) + 1U)) == NULL ||
+			     (ohb = malloc(ol.nhid * sizeof(*ohb) + 1U)) == NULL ||
+			     (ow = malloc(ol.nvis * ol.nhid * sizeof(*ow) + 1U)) == NULL)) {
+			goto out;
+		}
+		memcpy(ovb, m->vbias, ol.nvis * sizeof(*ovb));
+		memcpy(ohb, m->hbias, ol.nhid * sizeof(*ohb));
+		for (size_t i = 0; i < ol.nvis; i++) {
+			el_ld_row(ow + i * ol.nhid,
+				  (const char*)m->w + i * oldw * oez, oet,
+				  ol.nhid);
+		}
+	}
+	if (movp || fz > p->f.fb.z) {
+		munmap_fd(p->f.fb);
+		if (UNLIKELY(ftruncate(p->f.fd, fz) < 0)) {
+			p->f.fb = (glodf_t){.z = 0U, .d = NULL};
+			goto out;
+		} else if (UNLIKELY((p->f.fb = mmap_fd(p->f.fd, fz, pr, fl)).d == NULL)) {
+			goto out;
+		}
+	}
+
+	with (struct dl_file_s *fp = p->f.fb.d) {
+		const float vnois = .1f;
+		const float hnois = .01f;
+		const float wnois = 1.f / (nu.nvis * nu.nhid);
+		const size_t mvis = ol.nvis < nu.nvis ? ol.nvis : nu.nvis;
+		const size_t mhid = ol.nhid < nu.nhid ? ol.nhid : nu.nhid;
+		const size_t ez = el_size(hdr.etype);
+		char *dp = p->f.fb.d;
+
+		*fp = hdr;
+		m->nvis = nu.nvis;
+		m->nhid = nu.nhid;
+		m->vbias = (float*)(dp + hdr.off[DL_SECT_VBIAS]);
+		m->hbias = (float*)(dp + hdr.off[DL_SECT_HBIAS]);
+		m->w = dp + hdr.off[DL_SECT_W];
+		m->ldw = hdr.chid;
+		m->etype = (dl_etype_t)hdr.etype;
+
+#define w(i, j)		((char*)m->w + (i * m->ldw + j) * ez)
+		if (movp) {
+			/* put old cells into their new places */
+			memcpy(m->vbias, ovb, mvis * sizeof(*ovb));
+			memcpy(m->hbias, ohb, mhid * sizeof(*ohb));
+			for (size_t i = 0; i < mvis; i++) {
+				el_st_row(w(i, 0U), m->etype,
+					  ow + i * ol.nhid, mhid);
+			}
+		}
+
+		/* vbiasses, wobble */
+		for (size_t i = mvis; i < m->nvis; i++) {
+			const float x = dr_rand_uni();
+			m->vbias[i] = log(vnois * x);
+		}
+
+		/* hbiasses, wobble */
+		nois(m->hbias + mhid, m->nhid - mhid, hnois);
+
+		/* weight matrix, row by row, wobble new columns ... */
+		for (size_t i = 0; i < mvis; i++) {
+			nois(rw, m->nhid - mhid, wnois);
+			el_st_row(w(i, mhid), m->etype, rw, m->nhid - mhid);
+		}
+		/* ... and new rows */
+		for (size_t i = mvis; i < m->nvis; i++) {
+			nois(rw, m->nhid, wnois);
+			el_st_row(w(i, 0U), m->etype, rw, m->nhid);
+		}
+#undef w
+
+		/* recalc the transposed of w, if on file,
+		 * otherwise wtr_of() will see to it when needed */
+		if (hdr.flags & DL_FL_WTR) {
+			p->wtr = dp + hdr.off[DL_SECT_WTR];
+			p->ldwtr = hdr.cvis;
+
+			if (movp || !(ofl & DL_FL_WTR)) {
+				tr_box(m, 0U, m->nvis, 0U, m->nhid);
+			} else {
+				/* only the new cells */
+				tr_box(m, 0U, mvis, mhid, m->nhid);
+				tr_box(m, mvis, m->nvis, 0U, m->nhid);
+			}
+		}
+
+		/* int8 weights are requantised from scratch, scales
+		 * depend on whole rows of the transpose */
+		q8_attach(m);
+		if (p->q8 != NULL) {
+			q8_mk(m);
+		}
+	}
+	res = 0;
+
+out:
+	free(ovb);
+	free(ohb);
+	free(ow);
+	free(rw);
+	return res;
+}
+
+static dl_rbm_t
+crea(
+	const char *file, struct dl_spec_s sp, struct dl_spec_s cap,
+	uint64_t flags, dl_etype_t et)
+{
+	static glodfn_t f;
+	const int pr = PROT_READ | PROT_WRITE;
+	const int fl = MAP_SHARED;
+	size_t fz;
+	int fd;
+	dl_rbm_t res;
+
+	if (UNLIKELY(jnl_rm(file) < 0)) {
+		/* a stale journal would be replayed over the new machine */
+		return NULL;
+	} else if (UNLIKELY((fd = open(file, O_CREAT | O_RDWR | O_TRUNC, 0666)) < 0)) {
+		return NULL;
+	}
+	/* start out with an empty machine */
+	with (struct dl_file_s hdr = {
+		      .magic = DL_MAGIC,
+		      .version = DL_VERSION,
+		      .etype = et,
+		      .mtype = DL_MT_POISS_BIN,
+	      }) {
+		fz = mk_layout(&hdr);
+		if (UNLIKELY(ftruncate(fd, fz) < 0)) {
+			goto out;
+		} else if (UNLIKELY((f.fb = mmap_fd(f.fd = fd, fz, pr, fl)).d == NULL)) {
+			goto out;
+		}
+		memcpy(f.fb.d, &hdr, sizeof(hdr));
+	}
+	munmap_fn(f);
+
+	/* now let pump() and resz() do the rest */
+	if ((res = pump(file, O_RDWR)) == NULL) {
+		/* nawww */
+		goto out;
+	} else if (resz(res, sp, cap, flags, DL_ET_UNK) < 0) {
+		/* shame */
+		goto out;
+	}
+	/* all's good */
+	return res;
+
+out:
+	close(fd);
+	return NULL;
+}
+
+
+/* checkpoints, the machine is mapped privately (or lives in anonymous
+ * memory altogether) and snapshots of it are written by a forked child
+ * (which sees a frozen copy courtesy of copy-on-write) to a temporary
+ * file that is then renamed over the machine file, so the file on disk
+ * is always a consistent machine */
+static pid_t ckpt_pid;
+
+static int
+wr_img(const char *file, const void *d, size_t z, mode_t mo)
+{
+/* write Z bytes at D to a temporary next to FILE and move it over FILE */
+	char tmp[PATH_MAX];
+	int fd;
+
+	if (UNLIKELY((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >=
+		     sizeof(tmp))) {
+		return -1;
+	} else if (UNLIKELY((fd = mkstemp(tmp)) < 0)) {
+		return -1;
+	}
+	for (const char *dp = d; z > 0U;) {
+		const ssize_t nwr = write(fd, dp, z);
+
+		if (UNLIKELY(nwr < 0 && errno == EINTR)) {
+			continue;
+		} else if (UNLIKELY(nwr < 0)) {
+			goto fail;
+		}
+		dp += nwr;
+		z -= nwr;
+	}
+	if (UNLIKELY(fchmod(fd, mo & 0777) < 0 || fsync(fd) < 0)) {
+		goto fail;
+	}
+	close(fd);
+	/* the image supersedes any journal, losing the journal before
+	 * the rename leaves an older but consistent machine on disk,
+	 * the other way round would replay stale rows over the image */
+	if (UNLIKELY(jnl_rm(file) < 0)) {
+		unlink(tmp);
+		return -1;
+	} else if (UNLIKELY(rename(tmp, file) < 0)) {
+		unlink(tmp);
+		return -1;
+	}
+	/* make the rename itself durable */
+	with (char *sl = strrchr(tmp, '/')) {
+		if (sl != NULL) {
+			*sl = '\0';
+		}
+		if ((fd = open(sl != NULL ? tmp : ".", O_RDONLY)) >= 0) {
+			(void)fsync(fd);
+			close(fd);
+		}
+	}
+	return 0;
+
+fail:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+static int
+ckpt_reap(int flags)
+{
+/* collect the last checkpointing child, FLAGS as in waitpid(2),
+ * return -1 if it failed, 1 if it's still running */
+	int st;
+
+	if (ckpt_pid <= 0) {
+		return 0;
+	}
+	switch (waitpid(ckpt_pid, &st, flags)) {
+	case 0:
+		return 1;
+	case -1:
+		break;
+	default:
+		if (WIFEXITED(st) && WEXITSTATUS(st) == 0) {
+			ckpt_pid = 0;
+			return 0;
+		}
+		break;
+	}
+	ckpt_pid = 0;
+	return -1;
+}
+
+static int
+ckpt(dl_rbm_t m, const char *file)
+{
+/* snapshot M to FILE in the background,
+ * skip it if the previous snapshot is still being flushed */
+	const struct dl_rbm_priv_s *p = m->priv;
+	struct stat st;
+
+	switch (ckpt_reap(WNOHANG)) {
+	case 1:
+		return 0;
+	case -1:
+		fprintf(stderr, "checkpointing to `%s' failed\n", file);
+		break;
+	default:
+		break;
+	}
+	if (UNLIKELY(fstat(p->f.fd, &st) < 0)) {
+		return -1;
+	}
+	switch ((ckpt_pid = fork())) {
+	case -1:
+		ckpt_pid = 0;
+		return -1;
+	case 0:
+		/* don't let C-c cut the snapshot short */
+		signal(SIGINT, SIG_IGN);
+		_exit(wr_img(file, p->f.fb.d, p->f.fb.z, st.st_mode) < 0);
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int
+ckpt_sync(dl_rbm_t m, const char *file)
+{
+/* wait for the background snapshot, then write M to FILE synchronously */
+	const struct dl_rbm_priv_s *p = m->priv;
+	struct stat st;
+
+	if (UNLIKELY(ckpt_reap(0) < 0)) {
+		fprintf(stderr, "checkpointing to `%s' failed\n", file);
+	}
+	if (UNLIKELY(fstat(p->f.fd, &st) < 0)) {
+		return -1;
+	}
+	return wr_img(file, p->f.fb.d, p->f.fb.z, st.st_mode);
+}
+
+static int
+jnl_wr(dl_rbm_t m, const char *file, const uint64_t *drt)
+{
+/* append a frame with the rows of M flagged in bitmap DRT to FILE's
+ * journal, synchronously and under the journal's lock, a failed append
+ * is cut off again */
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+	const size_t ez = el_size(m->etype);
+	struct dl_jnl_s hdr = {
+		.magic = DL_JNL_MAGIC,
+		.etype = m->etype,
+		.nvis = nv,
+		.nhid = nh,
+	};
+	struct dl_jnl_end_s end = {
+		.magic = DL_JNL_EMAGIC,
+	};
+	char jfn[PATH_MAX];
+	struct stat st;
+	FILE *fp;
+	int fd;
+
+	for (size_t k = 0; k < DRT_NW(nv); k++) {
+		hdr.nrow += __builtin_popcountll(drt[k]);
+	}
+	end.z = jnl_frmz(nv, nh, hdr.nrow, ez);
+
+	if (UNLIKELY(jnl_fn(jfn, sizeof(jfn), file) < 0)) {
+		return -1;
+	} else if (UNLIKELY((fd = open(
+				     jfn, O_WRONLY | O_APPEND | O_CREAT,
+				     0666)) < 0)) {
+		return -1;
+	}
+	while (UNLIKELY(flock(fd, LOCK_EX) < 0)) {
+		if (errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+	if (UNLIKELY(fstat(fd, &st) < 0 ||
+		     (fp = fdopen(fd, "a")) == NULL)) {
+		close(fd);
+		return -1;
+	}
+	/* rows are big, write them through a big buffer */
+	setvbuf(fp, NULL, _IOFBF, 1U << 20U);
+
+	fwrite(&hdr, sizeof(hdr), 1U, fp);
+	fwrite(m->vbias, sizeof(*m->vbias), nv, fp);
+	fwrite(m->hbias, sizeof(*m->hbias), nh, fp);
+	for (size_t k = 0; k < DRT_NW(nv); k++) {
+		for (uint64_t b = drt[k]; b; b &= b - 1U) {
+			const uint64_t i = k * 64U + __builtin_ctzll(b);
+
+			fwrite(&i, sizeof(i), 1U, fp);
+			fwrite((const char*)m->w + i * m->ldw * ez, ez, nh, fp);
+		}
+	}
+	fwrite(&end, sizeof(end), 1U, fp);
+
+	if (UNLIKELY(fflush(fp) || ferror(fp) || fsync(fd) < 0)) {
+		/* don't leave a torn frame behind */
+		(void)ftruncate(fd, st.st_size);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+/* sparse integer vectors */
+typedef struct spsc_s spsc_t;
+typedef struct spsv_s spsv_t;
+
+struct spsc_s {
+	size_t i;
+	uint8_t v;
+};
+
+struct spsv_s {
+	size_t z;
+	spsc_t *v;
+};
+
+static int
+snarf_tf(spsc_t *restrict tgt, const char *ln, const char *eol)
+{
+/* read a term id and its count off line LN ending in EOL (a newline)
+ * into TGT, return -1 if LN isn't of the form ID<TAB>COUNT<NL> */
+	char *p;
+	char *q;
+	long unsigned int v;
+	long unsigned int c;
+
+	/* read the term id, strtoul() might skip past EOL */
+	v = strtoul(ln, &p, 0);
+	if (p >= eol || *p++ != '\t') {
+		return -1;
+	}
+	/* read the count */
+	c = strtoul(p, &q, 0);
+	if (q != eol) {
+		/* try a decimal, like the probabilities of prop --top-k,
+		 * and round it up so every listed unit counts */
+		const double d = strtod(p, &q);
+
+		if (q != eol || !(d >= 0.)) {
+			return -1;
+		}
+		if ((double)(c = (long unsigned int)d) < d) {
+			c++;
+		}
+	}
+	/* assign index/value pair */
+	tgt->i = v;
+	tgt->v = c;
+	return 0;
+}
+
+static spsv_t
+read_tf(const int fd)
+{
+	static char *line;
+	static size_t llen;
+	static struct spsc_s *spsv;
+	static size_t spsz;
+	ssize_t nrd;
+	size_t i = 0U;
+
+	if (UNLIKELY(fd < 0)) {
+		if (line != NULL) {
+			free(line);
+		}
+		if (spsv != NULL) {
+			free(spsv);
+		}
+		return (spsv_t){.z = 0U, .v = NULL};
+	}
+
+	/* now then */
+	while ((nrd = getline(&line, &llen, stdin)) > 0) {
+		/* check for form feeds, and maybe yield */
+		if (*line == '\f') {
+			break;
+		}
+
+		if (UNLIKELY(i >= spsz)) {
+			/* extend vector */
+			size_t nu = spsz + 256U;
+			spsv = realloc(spsv, nu * sizeof(*spsv));
+			spsz = nu;
+		}
+		if (snarf_tf(spsv + i, line, line + nrd - 1) == 0) {
+			i++;
+		}
+	}
+	return (spsv_t){.z = i, .v = spsv};
+}
+
+static size_t
+popul_sv(float *restrict x, size_t z, const spsv_t sv)
+{
+/* Populate the bottom visible layer X (hopefully large enough)
+ * with values from sparse vector SV, counts of a term that occurs
+ * more than once add up, as they do in prop_up_csr().
+ * Return the total number of words. */
+	size_t res = 0U;
+
+	memset(x, 0, z * sizeof(*x));
+	for (size_t j = 0; j < sv.z; j++) {
+		size_t i = sv.v[j].i;
+		uint8_t c = sv.v[j].v;
+
+		if (UNLIKELY(i >= z)) {
+			fprintf(stderr, "\
+not populating entry %zu, machine's network too small\n", i);
+			continue;
+		}
+
+		res += c;
+		x[i] += (float)(int)c;
+	}
+	return res;
+}
+
+static void
+quant_vis(
+	uint8_t *restrict x, float *restrict xs,
+	const float *v, const float *r, size_t z)
+{
+/* requantise the visible layer V to the uint8 layer that goes with
+ * int8 weights, V is multiplied by the scales R first, so that
+ * X times *XS approximates R times V */
+	float xmax = 0.f;
+
+	for (size_t i = 0; i < z; i++) {
+		xmax = r[i] * v[i] > xmax ? r[i] * v[i] : xmax;
+	}
+	*xs = xmax / 255.f;
+	for (size_t i = 0; i < z; i++) {
+		x[i] = xmax > 0.f
+			? (uint8_t)lrintf(r[i] * v[i] * 255.f / xmax) : 0U;
+	}
+	return;
+}
+
+
+#if !defined NDEBUG
+static void
+dump_layer(const char *pre, const float *x, size_t z)
+{
+	float minx = INFINITY;
+	float maxx = -INFINITY;
+
+	for (size_t i = 0; i < z; i++) {
+		if (x[i] < minx) {
+			minx = x[i];
+		}
+		if (x[i] > maxx) {
+			maxx = x[i];
+		}
+	}
+	printf("%s (%.6g  %.6g)\n", pre, minx, maxx);
+	return;
+}
+
+static size_t
+count_layer(const float *x, size_t z)
+{
+	size_t sum = 0U;
+
+	for (size_t i = 0; i < z; i++) {
+		if (x[i] > 0.f) {
+			sum++;
+		}
+	}
+	return sum;
+}
+
+static float
+integ_layer(const float *x, size_t z)
+{
+	float sum = 0U;
+
+	for (size_t i = 0; i < z; i++) {
+		if (x[i] > 0.f) {
+			sum += x[i];
+		}
+	}
+	return sum;
+}
+#endif	/* !NDEBUG */
+
+
+/* propagation, gibbs sampling and learning */
+/* global parameters */
+#if defined SALAKHUTDINOV
+static size_t N;
+#endif	/* SALAKHUTDINOV */
+
+/* visible rates above this are sampled one by one, the rest skip-sampled */
+#define SMPL_VIS_HOT	0.05f
+
+static ni int
+prop_up(float *restrict h, dl_rbm_t m, const float vis[static m->nvis])
+{
+/* propagate visible units activation upwards to the hidden units (recon) */
+	const size_t nvis = m->nvis;
+	const size_t nhid = m->nhid;
+	const dl_etype_t et = m->etype;
+	const char *wtr = wtr_of(m);
+	const size_t ld = ((const struct dl_rbm_priv_s*)m->priv)->ldwtr;
+	const float *b = m->hbias;
+
+#define w(j)		(wtr + j * ld * el_size(et))
+	for (size_t j = 0; j < nhid; j++) {
+		h[j] = b[j] + el_sdot(nvis, w(j), et, vis);
+	}
+#undef w
+	return 0;
+}
+
+static ni int
+prop_up_q8(
+	float *restrict h, dl_rbm_t m,
+	const uint8_t vis[static m->nvis], float vs)
+{
+/* like prop_up() but with M's int8 weights and a visible layer as
+ * populated by quant_vis() whose scale is VS */
+	const struct dl_rbm_priv_s *p = m->priv;
+	const size_t nvis = m->nvis;
+	const size_t nhid = m->nhid;
+	const int8_t *q8 = p->q8;
+	const float *b = m->hbias;
+
+#define q(j)		(q8 + j * p->ldq8)
+	for (size_t j = 0; j < nhid; j++) {
+		const int32_t d = q8_sdot(nvis, q(j), vis);
+
+		h[j] = b[j] + vs * (float)d;
+	}
+#undef q
+	return 0;
+}
+
+static ni int
+prop_up_sp(
+	float *restrict h, dl_rbm_t m,
+	const size_t *vi, const float *vis, size_t nz)
+{
+/* like prop_up() but for visible units in sparse form */
+	const size_t nhid = m->nhid;
+	const size_t ld = m->ldw;
+	const dl_etype_t et = m->etype;
+	const char *w = m->w;
+
+	memcpy(h, m->hbias, nhid * sizeof(*h));
+#define w(i)		(w + i * ld * el_size(et))
+	for (size_t k = 0; k < nz; k++) {
+		el_saxpy(nhid, vis[k], w(vi[k]), et, h);
+	}
+#undef w
+	return 0;
+}
+
+static ni int
+expt_hid(float *restrict h, dl_rbm_t m, const float hid[static m->nhid])
+{
+	const size_t nhid = m->nhid;
+
+	DEBUG(dump_layer("Ha", hid, nhid));
+
+	for (size_t j = 0; j < nhid; j++) {
+		h[j] = sigma(hid[j]);
+	}
+	return 0;
+}
+
+static ni int
+smpl_hid(
+	float *restrict h, dl_rbm_t m, const float hid[static m->nhid],
+	const float *u)
+{
+/* infer hidden unit states given vis(ible units)
+ * if non-NULL, U is expected to hold nhid uniforms to flip coins with */
+	const size_t nhid = m->nhid;
+
+	DEBUG(dump_layer("He", hid, nhid));
+
+	if (u == NULL) {
+		for (size_t j = 0; j < nhid; j++) {
+			/* just flip a coin */
+			h[j] = dr_rand_binom1(hid[j]);
+		}
+	} else {
+		for (size_t j = 0; j < nhid; j++) {
+			/* flip a pre-generated coin */
+			h[j] = hid[j] > u[j] ? 1.f : 0.f;
+		}
+	}
+
+	DEBUG(dump_layer("Hs", h, nhid));
+	return 0;
+}
+
+static void
+smpl_bits(
+	uint8_t *restrict b,
+	const unsigned int *t, const unsigned int *u, const size_t n)
+{
+/* set bit J of B (lsb first) iff U[J] < T[J], i.e. draw N binary units
+ * with probabilities T/2^32 from the uniform words U */
+	size_t j = 0U;
+
+#if defined __SSE2__
+	/* there's no unsigned compare, shift both sides by 2^31 */
+	with (const __m128i sgn = _mm_set1_epi32(INT32_MIN)) {
+		for (; j + 8U <= n; j += 8U) {
+			const __m128i t0 = _mm_loadu_si128((const void*)(t + j));
+			const __m128i t1 = _mm_loadu_si128((const void*)(t + j + 4U));
+			const __m128i u0 = _mm_loadu_si128((const void*)(u + j));
+			const __m128i u1 = _mm_loadu_si128((const void*)(u + j + 4U));
+			const __m128i c0 = _mm_cmplt_epi32(
+				_mm_xor_si128(u0, sgn), _mm_xor_si128(t0, sgn));
+			const __m128i c1 = _mm_cmplt_epi32(
+				_mm_xor_si128(u1, sgn), _mm_xor_si128(t1, sgn));
+
+			b[j / 8U] = (uint8_t)(
+				_mm_movemask_ps(_mm_castsi128_ps(c0)) |
+				_mm_movemask_ps(_mm_castsi128_ps(c1)) << 4U);
+		}
+	}
+#endif	/* __SSE2__ */
+	for (; j < n; j += 8U) {
+		const size_t k = n - j < 8U ? n - j : 8U;
+		unsigned int x = 0U;
+
+		for (size_t i = 0U; i < k; i++) {
+			x |= (unsigned int)(u[j + i] < t[j + i]) << i;
+		}
+		b[j / 8U] = (uint8_t)x;
+	}
+	return;
+}
+
+static ni int
+prop_down(float *restrict v, dl_rbm_t m, const float hid[static m->nhid])
+{
+/* propagate hidden units activation downwards to the visible units */
+	const size_t nvis = m->nvis;
+	const size_t nhid = m->nhid;
+	const size_t ld = m->ldw;
+	const dl_etype_t et = m->etype;
+	const char *w = m->w;
+	const float *b = m->vbias;
+
+#define w(i)		(w + i * ld * el_size(et))
+	for (size_t i = 0; i < nvis; i++) {
+		v[i] = b[i] + el_sdot(nhid, w(i), et, hid);
+	}
+#undef w
+	return 0;
+}
+
+static ni int
+expt_vis(float *restrict v, dl_rbm_t m, const float vis[static m->nvis])
+{
+	const size_t nvis = m->nvis;
+
+	DEBUG(dump_layer("Va", vis, nvis));
+
+#if defined SALAKHUTDINOV
+	softmax(v, vis, nvis);
+	with (const float scal = (float)N) {
+		for (size_t i = 0; i < nvis; i++) {
+			v[i] *= scal;
+		}
+	}
+#elif defined GEHLER
+	for (size_t i = 0; i < nvis; i++) {
+		v[i] = exp(vis[i]);
+	}
+#elif defined BINOM_INPUT
+	for (size_t i = 0; i < nvis; i++) {
+		v[i] = sigma(vis[i]);
+	}
+#endif	/* impls */
+	return 0;
+}
+
+static ni size_t
+smpl_vis(
+	size_t *restrict vi, float *restrict v,
+	dl_rbm_t m, const float vis[static m->nvis])
+{
+/* infer visible unit states given hid(den units)
+ * only the non-zero states are stored, indices in VI, values in V,
+ * return their number */
 	const size_t nvis = m->nvis;
+	size_t nz = 0U;
+
+	DEBUG(dump_layer("Ve", vis, nvis));
+
+	/* vis is expected to contain the lambda values */
+#if !defined BINOM_INPUT
+	nz = dr_rand_poiss_sp(vi, v, vis, nvis, SMPL_VIS_HOT);
+#else  /* BINOM_INPUT */
+	for (size_t i = 0; i < nvis; i++) {
+		if (dr_rand_binom1(vis[i]) > 0.f) {
+			vi[nz] = i;
+			v[nz] = 1.f;
+			nz++;
+		}
+	}
+#endif	/* !BINOM_INPUT */
+	return nz;
+}
+
+static size_t
+popul_sp(
+	float *restrict x, size_t z,
+	const size_t *xi, const float *xv, size_t nz)
+{
+/* like popul_sv() but for sparse samples as returned by smpl_vis(),
+ * indices beyond Z are skipped */
+	size_t res = 0U;
+
+	memset(x, 0, z * sizeof(*x));
+	for (size_t k = 0; k < nz; k++) {
+		if (LIKELY(xi[k] < z)) {
+			res += (size_t)(x[xi[k]] = xv[k]);
+		}
+	}
+	return res;
+}
+
+
+/* cache of hidden expectations by document, for inputs that come round
+ * again and again, documents are known by a hash of their terms sorted
+ * by id, the cache has NSET sets of PCCH_WAYS entries and within a set
+ * CLOCK picks the entry to evict, each context owns its cache so there's
+ * nothing to lock,
+ * only the 64-bit hash is kept, not the terms, so two documents whose
+ * hashes collide get each other's expectations, at about 2^-64 per
+ * pair of documents that's a risk we take for the memory saved */
+#define PCCH_WAYS	8U
+
+struct pcch_s {
+	size_t nset;
+	size_t nh;
+	/* per entry the document's hash, 0 for empty entries,
+	 * and whether it's been used since the hand last passed */
+	uint64_t *key;
+	uint8_t *ref;
+	/* per set the clock hand */
+	uint8_t *hand;
+	/* per entry NH expectations */
+	float *h;
+
+	/* scratch for sorting the terms of a document */
+	spsc_t *srt;
+	size_t zsrt;
+
+	size_t nhit;
+	size_t nmiss;
+	size_t nevct;
+};
+
+static struct pcch_s*
+make_pcch(size_t n, size_t nh)
+{
+/* return a cache for at least N documents of NH hidden units each */
+	struct pcch_s *res = calloc(1U, sizeof(*res));
+	size_t ne;
+
+	if (UNLIKELY(res == NULL)) {
+		return NULL;
+	}
+	res->nset = (n + PCCH_WAYS - 1U) / PCCH_WAYS + !n;
+	res->nh = nh;
+	ne = res->nset * PCCH_WAYS;
+	res->key = calloc(ne, sizeof(*res->key));
+	res->ref = calloc(ne, sizeof(*res->ref));
+	res->hand = calloc(res->nset, sizeof(*res->hand));
+	res->h = malloc(ne * nh * sizeof(*res->h));
+	if (UNLIKELY(res->key == NULL || res->ref == NULL ||
+		     res->hand == NULL || res->h == NULL)) {
+		free(res->key);
+		free(res->ref);
+		free(res->hand);
+		free(res->h);
+		free(res);
+		return NULL;
+	}
+	return res;
+}
+
+static void
+free_pcch(struct pcch_s *c)
+{
+	free(c->key);
+	free(c->ref);
+	free(c->hand);
+	free(c->h);
+	free(c->srt);
+	free(c);
+	return;
+}
+
+static int
+cmp_spsc(const void *x, const void *y)
+{
+	const spsc_t *a = x;
+	const spsc_t *b = y;
+
+	if (a->i != b->i) {
+		return (a->i > b->i) - (a->i < b->i);
+	}
+	return (a->v > b->v) - (a->v < b->v);
+}
+
+static inline uint64_t
+mix64(uint64_t x)
+{
+/* splitmix64's finaliser */
+	x ^= x >> 30U;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27U;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31U;
+	return x;
+}
+
+static uint64_t
+pcch_key(struct pcch_s *restrict c, spsv_t sv)
+{
+/* return the hash of SV's terms in id order, never 0,
+ * or 0 if SV can't be hashed and mustn't be cached */
+	uint64_t k = sv.z;
+
+	if (UNLIKELY(sv.z > c->zsrt)) {
+		spsc_t *s = realloc(c->srt, sv.z * sizeof(*s));
+
+		if (UNLIKELY(s == NULL)) {
+			return 0U;
+		}
+		c->srt = s;
+		c->zsrt = sv.z;
+	}
+	memcpy(c->srt, sv.v, sv.z * sizeof(*sv.v));
+	qsort(c->srt, sv.z, sizeof(*c->srt), cmp_spsc);
+	for (size_t j = 0U; j < sv.z; j++) {
+		k = mix64(k ^ ((uint64_t)c->srt[j].i << 8U | c->srt[j].v));
+	}
+	return k + !k;
+}
+
+static float*
+pcch_get(struct pcch_s *restrict c, uint64_t k, bool *restrict hitp)
+{
+/* return the expectations cached under key K if *HITP, or else
+ * the entry K now owns, to be filled in by the caller */
+	const size_t s = (size_t)(k % c->nset);
+	uint64_t *restrict ks = c->key + s * PCCH_WAYS;
+	uint8_t *restrict rs = c->ref + s * PCCH_WAYS;
+	size_t w;
+
+	for (w = 0U; w < PCCH_WAYS; w++) {
+		if (ks[w] == k) {
+			rs[w] = 1U;
+			c->nhit++;
+			*hitp = true;
+			return c->h + (s * PCCH_WAYS + w) * c->nh;
+		}
+	}
+	/* sweep past the recently used, taking their second chance */
+	for (w = c->hand[s]; rs[w]; w = (w + 1U) % PCCH_WAYS) {
+		rs[w] = 0U;
+	}
+	c->hand[s] = (uint8_t)((w + 1U) % PCCH_WAYS);
+	c->nevct += ks[w] != 0U;
+	c->nmiss++;
+	ks[w] = k;
+	rs[w] = 1U;
+	*hitp = false;
+	return c->h + (s * PCCH_WAYS + w) * c->nh;
+}
+
+static void
+pcch_prnt(const struct pcch_s *c, FILE *out)
+{
+	const size_t n = c->nhit + c->nmiss;
+
+	fprintf(out, "\
+cache: %zu hits, %zu misses, %zu evictions, hit rate %.2f%%\n",
+		c->nhit, c->nmiss, c->nevct,
+		n ? 100. * (double)c->nhit / (double)n : 0.);
+	return;
+}
+
+/* training and classifying modes */
+typedef struct drbctx_s *drbctx_t;
+
+struct drbctx_s {
+	dl_rbm_t m;
+
+	/* some scratch vectors for the gibbs sampling */
+	float *vo;
+	float *ho;
+	float *vr;
+	float *hr;
+
+	/* sparse form of the visible sample */
+	size_t *vsi;
+	float *vsv;
+
+	/* difference vectors */
+	float *dh;
+	float *dv;
+	float *dw;
+	/* the map dw lives in, see mmap_big() */
+	glodf_t dwm;
+	/* a row's worth of random words for stochastic rounding,
+	 * only with narrow weights */
+	unsigned int *srnd;
+	/* visible layer as uint8 and its scale, only with int8 weights */
+	uint8_t *vq;
+	float vqs;
+
+	/* pre-generated randomness, if any */
+	dr_pool_t rp;
+
+	/* rows of w touched in the current batch, as bitmap and as list,
+	 * with sparse input these are the only rows with non-zero dw */
+	uint64_t *bdrt;
+	size_t *drw;
+	size_t ndrw;
+	/* rows touched since the last journal frame */
+	uint64_t *cdrt;
+
+	/* per visible unit counters for prop_up_csr(), all 0 in between */
+	size_t *tcnt;
+
+	/* hidden layer as fixed-point thresholds, random words to compare
+	 * them against, and the packed sample, see out_smpl() */
+	unsigned int *sthr;
+	unsigned int *sunf;
+	uint8_t *sbit;
+
+	/* sparse output of expectations, the TOPK most probable units
+	 * at least MINP, 0 for no limit, and a heap to select them in,
+	 * see out_top() */
+	size_t topk;
+	float minp;
+	size_t *hsel;
+
+	/* cache of expectations by document, if any, see pcch_get() */
+	struct pcch_s *pc;
+	/* ids of M's hidden units in the machine it was gathered from,
+	 * NULL if M is a whole machine, see sub_rbm() */
+	const size_t *unit;
+};
+
+/* number of hidden layers worth of uniforms per pool buffer */
+#define RP_NLAYERS	64U
+
+static const float eta = 0.02f;
+static const float mom = 0.9f;
+static const float dec = 0.f;
+
+static inline void
+mark_row(drbctx_t ctx, size_t i)
+{
+/* note that row I of w is touched in this batch */
+	const uint64_t b = 1ULL << (i % 64U);
+
+	if (!(ctx->bdrt[i / 64U] & b)) {
+		ctx->bdrt[i / 64U] |= b;
+		ctx->drw[ctx->ndrw++] = i;
+	}
+	return;
+}
+
+static void
+fini_drbctx(struct drbctx_s *tgt)
+{
+	tgt->m = NULL;
+
+	free(tgt->vo);
+	free(tgt->vr);
+	free(tgt->ho);
+	free(tgt->hr);
+
+	free(tgt->vsi);
+	free(tgt->vsv);
+
+	if (tgt->dwm.d != NULL) {
+		munmap_fd(tgt->dwm);
+	}
+	free(tgt->dv);
+	free(tgt->dh);
+	free(tgt->srnd);
+	free(tgt->vq);
+
+	free(tgt->bdrt);
+	free(tgt->cdrt);
+	free(tgt->drw);
+	free(tgt->tcnt);
+	free(tgt->sthr);
+	free(tgt->sunf);
+	free(tgt->sbit);
+	free(tgt->hsel);
+	if (tgt->pc != NULL) {
+		free_pcch(tgt->pc);
+		tgt->pc = NULL;
+	}
+
+	if (tgt->rp != NULL) {
+		free_dr_pool(tgt->rp);
+		tgt->rp = NULL;
+	}
+	return;
+}
+
+static int
+init_drbctx(struct drbctx_s *restrict tgt, dl_rbm_t m, bool trnp)
+{
+/* set TGT up for machine M, with the buffers needed to train M if TRNP,
+ * propagating alone gets by without, return -1 if allocations fail */
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+	const bool nrwp = m->etype != DL_ET_F32;
+
+	memset(tgt, 0, sizeof(*tgt));
+	tgt->m = m;
+
+	/* initialise the scratch vectors */
+	tgt->vo = calloc(nv, sizeof(*tgt->vo));
+	tgt->ho = calloc(nh, sizeof(*tgt->ho));
+	tgt->hr = calloc(nh, sizeof(*tgt->hr));
+	tgt->vq = q8_p(m) ? calloc(nv, sizeof(*tgt->vq)) : NULL;
+
+	tgt->tcnt = calloc(nv, sizeof(*tgt->tcnt));
+	tgt->sthr = calloc(nh, sizeof(*tgt->sthr));
+	tgt->sunf = calloc(nh, sizeof(*tgt->sunf));
+	tgt->sbit = calloc((nh + 7U) / 8U, sizeof(*tgt->sbit));
+	tgt->hsel = calloc(nh, sizeof(*tgt->hsel));
+	if (UNLIKELY(tgt->vo == NULL || tgt->ho == NULL || tgt->hr == NULL ||
+		     (q8_p(m) && tgt->vq == NULL) ||
+		     tgt->tcnt == NULL || tgt->sthr == NULL ||
+		     tgt->sunf == NULL || tgt->sbit == NULL ||
+		     tgt->hsel == NULL)) {
+		goto nomem;
+	} else if (!trnp) {
+		return 0;
+	}
+
+	/* training wants the rest */
+	tgt->vr = calloc(nv, sizeof(*tgt->vr));
+	tgt->vsi = calloc(nv, sizeof(*tgt->vsi));
+	tgt->vsv = calloc(nv, sizeof(*tgt->vsv));
+
+	tgt->dwm = mmap_big(nh * nv * sizeof(*tgt->dw));
+	tgt->dw = tgt->dwm.d;
+	tgt->dh = calloc(nh, sizeof(*tgt->dh));
+	tgt->dv = calloc(nv, sizeof(*tgt->dv));
+	tgt->srnd = nrwp ? calloc(nh, sizeof(*tgt->srnd)) : NULL;
+
+	tgt->bdrt = calloc(DRT_NW(nv), sizeof(*tgt->bdrt));
+	tgt->cdrt = calloc(DRT_NW(nv), sizeof(*tgt->cdrt));
+	tgt->drw = calloc(nv, sizeof(*tgt->drw));
+	if (UNLIKELY(tgt->vr == NULL || tgt->vsi == NULL ||
+		     tgt->vsv == NULL || tgt->dw == NULL ||
+		     tgt->dh == NULL || tgt->dv == NULL ||
+		     (nrwp && tgt->srnd == NULL) ||
+		     tgt->bdrt == NULL || tgt->cdrt == NULL ||
+		     tgt->drw == NULL)) {
+		goto nomem;
+	}
+	if (dec != 0.f) {
+		/* decay touches every row */
+		for (size_t i = 0; i < nv; i++) {
+			mark_row(tgt, i);
+		}
+	}
+	return 0;
+
+nomem:
+	/* leave it so that another fini_drbctx() does no harm */
+	fini_drbctx(tgt);
+	memset(tgt, 0, sizeof(*tgt));
+	return -1;
+}
+
+static const float*
+ctx_uni(drbctx_t ctx, size_t n)
+{
+/* return N uniforms from CTX's pool, or NULL if it has none */
+	if (ctx->rp == NULL) {
+		return NULL;
+	}
+	return dr_pool_take(ctx->rp, DR_POOL_UNI, n);
+}
+
+static void
+rset_drbctx(struct drbctx_s *tgt)
+{
+	const size_t nv = tgt->m->nvis;
+	const size_t nh = tgt->m->nhid;
+
+	/* only touched rows of dw can be non-zero */
+	for (size_t k = 0; k < tgt->ndrw; k++) {
+		const size_t i = tgt->drw[k];
+
+		memset(tgt->dw + i * nh, 0, nh * sizeof(*tgt->dw));
+		tgt->bdrt[i / 64U] = 0U;
+	}
+	tgt->ndrw = 0U;
+	memset(tgt->dv, 0, nv * sizeof(*tgt->dv));
+	memset(tgt->dh, 0, nh * sizeof(*tgt->dh));
+	if (dec != 0.f) {
+		for (size_t i = 0; i < nv; i++) {
+			mark_row(tgt, i);
+		}
+	}
+	return;
+}
+
+static int
+ckpt_jnl(drbctx_t ctx, const char *file)
+{
+/* checkpoint the rows touched since the last checkpoint */
+	if (UNLIKELY(jnl_wr(ctx->m, file, ctx->cdrt) < 0)) {
+		/* keep the rows flagged, the next frame will have them */
+		return -1;
+	}
+	memset(ctx->cdrt, 0, DRT_NW(ctx->m->nvis) * sizeof(*ctx->cdrt));
+	return 0;
+}
+
+#if defined __SSE__ && defined DEFER_UPDATES && 0
+/* this version is slower than the sequential one */
+static ni void
+sse_update_w(drbctx_t ctx)
+{
+#define f4z		sizeof(float) * 4U
+	typedef float f4 __attribute__((aligned(f4z), vector_size(f4z)));
+	dl_rbm_t m = ctx->m;
+	const float *vo = ctx->vo;
+	const float *ho = ctx->ho;
+	const float *vr = ctx->vr;
+	const float *hr = ctx->hr;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+	float *restrict dw = ctx->dw;
+	const float *w = m->w;
+	const size_t ldw = m->ldw;
+#if !defined NDEBUG
+	float mind = INFINITY;
+	float maxd = -INFINITY;
+#endif	/* !NDEBUG */
+
+#define w(i, j)		(w + i * ldw + j)
+#define dw(i, j)	(dw + i * nh + j)
+
+	/* bang <v_i h_j> into weights */
+	for (size_t i = 0; i < nv; i++) {
+		for (size_t j = 0; j < nh; j += 4U) {
+			const f4 vo4 = {vo[i], vo[i], vo[i], vo[i]};
+			const f4 ho4 = *(const f4*)(ho + j);
+			const f4 vr4 = {vr[i], vr[i], vr[i], vr[i]};
+			const f4 hr4 = *(const f4*)(hr + j);
+			const f4 vho4 = vo4 * ho4;
+			const f4 vhr4 = vr4 * hr4;
+			f4 d = vho4 - vhr4;
+			static const f4 dec4 = {0.f, 0.f, 0.f, 0.f};
+			static const f4 eta4 = {0.02f, 0.02f, 0.02f, 0.02f};
+			static const f4 mom4 = {0.9f, 0.9f, 0.9f, 0.9f};
+
+			/* decay */
+			d -= dec4 * *(const f4*)w(i, j);
+			/* learning rate */
+			d *= eta4;
+			/* momentum term */
+			d += mom4 * *(const f4*)dw(i, j);
+
+#if !defined NDEBUG && 0
+			if (d < mind) {
+				mind = d;
+			}
+			if (d > maxd) {
+				maxd = d;
+			}
+#endif	/* !NDEBUG */
+			*(f4*)dw(i, j) = d;
+		}
+	}
+#if !defined NDEBUG
+	printf("dw (%.6g  %.6g)\n", mind, maxd);
+#endif	/* !NDEBUG */
+#undef w
+#undef dw
+	return;
+}
+#endif	/* __SSE__ */
+
+static ni void
+update_w(drbctx_t ctx)
+{
+	dl_rbm_t m = ctx->m;
+	const struct dl_rbm_priv_s *p = m->priv;
+	const float *vo = ctx->vo;
+	const float *ho = ctx->ho;
+	const float *vr = ctx->vr;
+	const float *hr = ctx->hr;
+	const size_t nh = m->nhid;
+	float *restrict dw = ctx->dw;
+	const size_t ldw = m->ldw;
+	const size_t UNUSED(ldwtr) = p->ldwtr;
+	const dl_etype_t et = m->etype;
+#if defined DEFER_UPDATES
+	const void *w = m->w;
+	const void *UNUSED(wtr) = p->wtr;
+#else  /* !DEFER_UPDATES */
+	void *restrict w = m->w;
+	void *restrict wtr = p->wtr;
+#endif	/* DEFER_UPDATES */
+#if !defined NDEBUG
+	float mind = INFINITY;
+	float maxd = -INFINITY;
+#endif	/* !NDEBUG */
+
+#define w(i, j)		el_ld(w, i * ldw + j, et)
+#define dw(i, j)	dw[i * nh + j]
+
+	/* bang <v_i h_j> into weights, rows without visible activity in
+	 * either phase (and so far in the batch) have d == 0 throughout */
+	for (size_t k = 0; k < ctx->ndrw; k++) {
+		const size_t i = ctx->drw[k];
+
+		for (size_t j = 0; j < nh; j++) {
+			float vho = vo[i] * ho[j];
+			float vhr = vr[i] * hr[j];
+			float d = vho - vhr;
+
+			/* decay */
+			if (dec != 0.f) {
+				d -= dec * w(i, j);
+			}
+			/* learning rate */
+			d *= eta;
+			/* momentum term */
+			d += mom * dw(i, j);
+
+#if !defined NDEBUG
+			if (d < mind) {
+				mind = d;
+			}
+			if (d > maxd) {
+				maxd = d;
+			}
+#endif	/* !NDEBUG */
+#if !defined DEFER_UPDATES
+			el_st(w, i * ldw + j, et, w(i, j) + d, EL_RN);
+			el_st(wtr, j * ldwtr + i, et, w(i, j), EL_RN);
+#endif	/* !DEFER_UPDATES */
+			dw(i, j) = d;
+		}
+	}
+#if !defined NDEBUG
+	printf("dw (%.6g  %.6g)\n", mind, maxd);
+#endif	/* !NDEBUG */
+#undef w
+#undef dw
+	return;
+}
+
+static ni void
+update_b(drbctx_t ctx)
+{
+	dl_rbm_t m = ctx->m;
+	const float *vo = ctx->vo;
+	const float *ho = ctx->ho;
+	const float *vr = ctx->vr;
+	const float *hr = ctx->hr;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+
+	/* the real update routine is here, called twice, for vb and hb */
+	auto void __upd(
+		float *restrict b, float *restrict db,
+		const float *o, const float *r, const size_t z)
+	{
+#if !defined NDEBUG
+		float mind = INFINITY;
+		float maxd = -INFINITY;
+#endif	/* !NDEBUG */
+
+		for (size_t i = 0; i < z; i++) {
+			float d = o[i] - r[i];
+
+			/* decay */
+			d -= dec * b[i];
+			/* learning rate */
+			d *= eta;
+			/* momentum */
+			d += mom * db[i];
+
+#if !defined NDEBUG
+			if (d < mind) {
+				mind = d;
+			}
+			if (d > maxd) {
+				maxd = d;
+			}
+#endif	/* !NDEBUG */
+#if !defined DEFER_UPDATES
+			b[i] +=
+#endif	/* !DEFER_UPDATES */
+				db[i] = d;
+		}
+#if !defined NDEBUG
+		printf("db (%.6g  %.6g)\n", mind, maxd);
+#endif	/* !NDEBUG */
+	}
+
+	/* bias update */
+	__upd(m->vbias, ctx->dv, vo, vr, nv);
+	__upd(m->hbias, ctx->dh, ho, hr, nh);
+	return;
+}
+
+static ni void
+final_update_w(drbctx_t ctx)
+{
+/* finalise the weight update */
+#if defined DEFER_UPDATES
+	dl_rbm_t m = ctx->m;
+	const size_t nh = m->nhid;
+	const dl_etype_t et = m->etype;
+	const size_t ez = el_size(et);
+	const struct dl_rbm_priv_s *p = m->priv;
+	const size_t *drw = ctx->drw;
+	const size_t ndrw = ctx->ndrw;
+	/* tile size for the transposed update */
+	const size_t tz = 64U;
+
+	/* whatever is touched now is dirty for the next journal frame */
+	for (size_t k = 0; k < DRT_NW(m->nvis); k++) {
+		ctx->cdrt[k] |= ctx->bdrt[k];
+	}
+
+#define w(i, j)		((char*)m->w + (i * m->ldw + j) * ez)
+#define dw(i, j)	(ctx->dw + i * nh + j)
+
+	/* now really bang <v_i h_j> into weights, narrow weights are
+	 * rounded stochastically or else updates smaller than half an ulp
+	 * would never make it */
+	for (size_t k = 0; k < ndrw; k++) {
+		const size_t i = drw[k];
+
+		if (ctx->srnd != NULL) {
+			dr_rand_int_n(ctx->srnd, nh);
+		}
+		el_sadd_sr(nh, w(i, 0U), et, dw(i, 0U), ctx->srnd);
+	}
+
+	if (p->wtr == NULL) {
+		/* not materialised, so nothing to keep in sync */
+		goto out;
+	}
+
+	/* copy the touched rows to the transpose, tile by tile, copying
+	 * rather than adding keeps it identical to w whatever the rounding */
+	for (size_t k0 = 0; k0 < ndrw; k0 += tz) {
+		const size_t k1 = k0 + tz < ndrw ? k0 + tz : ndrw;
+
+		for (size_t j0 = 0; j0 < nh; j0 += tz) {
+			const size_t j1 = j0 + tz < nh ? j0 + tz : nh;
+
+			for (size_t k = k0; k < k1; k++) {
+				const size_t i = drw[k];
+
+				tr_into((char*)p->wtr + (j0 * p->ldwtr + i) * ez,
+					p->ldwtr, w(i, j0), m->ldw,
+					1, j1 - j0, ez);
+			}
+		}
+	}
+out:
+#undef w
+#undef dw
+#else  /* !DEFER_UPDATES */
+	ctx = ctx;
+#endif	/* DEFER_UPDATES */
+	return;
+}
+
+static ni void
+final_update_b(drbctx_t ctx)
+{
+/* finalise the weight update */
+#if defined DEFER_UPDATES
+	const size_t nv = ctx->m->nvis;
+	const size_t nh = ctx->m->nhid;
+
+#define v(i)		ctx->m->vbias[i]
+#define dv(i)		ctx->dv[i]
+
+	/* now really bang bias updates into the biasses */
+	for (size_t i = 0; i < nv; i++) {
+		v(i) += dv(i);
+	}
+#undef v
+#undef dv
+
+#define h(i)		ctx->m->hbias[i]
+#define dh(i)		ctx->dh[i]
+	for (size_t j = 0; j < nh; j++) {
+		h(j) += dh(j);
+	}
+#else  /* !DEFER_UPDATES */
+	ctx = ctx;
+#endif	/* DEFER_UPDATES */
+	return;
+}
+
+static void
+train(drbctx_t ctx, struct spsv_s sv)
+{
+	const dl_rbm_t m = ctx->m;
+	float *restrict vo = ctx->vo;
+	float *restrict ho = ctx->ho;
+	float *restrict vr = ctx->vr;
+	float *restrict hr = ctx->hr;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+
+	DEBUG(float *hs = calloc(nh, sizeof(*hs)));
+
+	/* populate from input */
+#if defined SALAKHUTDINOV
+	N = popul_sv(vo, nv, sv);
+#else  /* !SALAKHUTDINOV */
+	(void)popul_sv(vo, nv, sv);
+#endif	/* SALAKHUTDINOV */
+	for (size_t k = 0; k < sv.z; k++) {
+		if (LIKELY(sv.v[k].i < nv)) {
+			mark_row(ctx, sv.v[k].i);
+		}
+	}
+
+	/* vh gibbs */
+	prop_up(ho, m, vo);
+	expt_hid(ho, m, ho);
+	/* don't sample into ho, use hr instead, we want the activations */
+	smpl_hid(hr, m, ho, ctx_uni(ctx, nh));
+	DEBUG(size_t nho = count_layer(hr, nh));
+
+	/* hv gibbs */
+	prop_down(vr, m, hr);
+	expt_vis(vr, m, vr);
+	with (size_t nz = smpl_vis(ctx->vsi, ctx->vsv, m, vr)) {
+		/* keep a dense copy for the updates */
+		(void)popul_sp(vr, nv, ctx->vsi, ctx->vsv, nz);
+		DEBUG(dump_layer("Vs", vr, nv));
+		for (size_t k = 0; k < nz; k++) {
+			mark_row(ctx, ctx->vsi[k]);
+		}
+
+		/* vh gibbs, only touching the rows of sampled words */
+		prop_up_sp(hr, m, ctx->vsi, ctx->vsv, nz);
+	}
+	expt_hid(hr, m, hr);
+
+	DEBUG(
+		smpl_hid(hs, m, hr, NULL);
+		size_t nhr = count_layer(hs, nh);
+		);
+
+#if !defined NDEBUG
+	size_t nso = count_layer(vo, nv);
+	size_t nsr = count_layer(vr, nv);
+	float Nso = integ_layer(vo, nv);
+	float Nsr = integ_layer(vr, nv);
+	printf("|vo| %zu  |vr| %zu  Nvo %.6g  Nvr %.6g\n", nso, nsr, Nso, Nsr);
+	printf("|ho| %zu  |hr| %zu\n", nho, nhr);
+#endif	/* !NDEBUG */
+
+	/* we won't sample the h reconstruction as we want to use the
+	 * the activations directly */
+	update_w(ctx);
+	update_b(ctx);
+
+#if !defined NDEBUG
+	dump_layer("h", m->hbias, nh);
+	dump_layer("v", m->vbias, nv);
+	if (m->etype == DL_ET_F32) {
+		dump_layer("w", m->w, nv * m->ldw);
+	}
+#endif	/* !NDEBUG */
+
+	DEBUG(free(hs));
+	return;
+}
+
+static int
+cmp_z(const void *x, const void *y)
+{
+	const size_t a = *(const size_t*)x;
+	const size_t b = *(const size_t*)y;
+
+	return (a > b) - (a < b);
+}
+
+static int
+prop_up_csr(float *restrict h, drbctx_t ctx, const rbm_csr_t *docs)
+{
+/* like prop_up_sp() but for a batch of documents, H gets a row of
+ * nhid activations per document,
+ * the batch is turned inside out first (to CSC) so that each row of w
+ * is loaded once and added to all documents featuring its term */
+	const dl_rbm_t m = ctx->m;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+	const size_t ld = m->ldw;
+	const dl_etype_t et = m->etype;
+	const char *w = m->w;
+	const size_t nnz = docs->ptr[docs->ndoc] - docs->ptr[0U];
+	size_t *restrict tc = ctx->tcnt;
+	/* terms in the batch, and the documents and counts per term */
+	size_t *trm = malloc(nnz * sizeof(*trm) + 1U);
+	size_t *ed = malloc(nnz * sizeof(*ed) + 1U);
+	float *ev = malloc(nnz * sizeof(*ev) + 1U);
+	size_t nt = 0U;
+
+	if (UNLIKELY(trm == NULL || ed == NULL || ev == NULL)) {
+		free(trm);
+		free(ed);
+		free(ev);
+		return -1;
+	}
+
+	/* count documents per term */
+	for (size_t k = docs->ptr[0U]; k < docs->ptr[docs->ndoc]; k++) {
+		const size_t i = docs->idx[k];
+
+		if (UNLIKELY(i >= nv)) {
+			continue;
+		} else if (!tc[i]++) {
+			trm[nt++] = i;
+		}
+	}
+	/* walk w in order, counts become offsets */
+	qsort(trm, nt, sizeof(*trm), cmp_z);
+	for (size_t t = 0U, o = 0U; t < nt; t++) {
+		const size_t c = tc[trm[t]];
+
+		tc[trm[t]] = o;
+		o += c;
+	}
+	for (size_t d = 0U; d < docs->ndoc; d++) {
+		for (size_t k = docs->ptr[d]; k < docs->ptr[d + 1U]; k++) {
+			const size_t i = docs->idx[k];
+
+			if (LIKELY(i < nv)) {
+				ed[tc[i]] = d;
+				ev[tc[i]] = docs->cnt[k];
+				tc[i]++;
+			}
+		}
+	}
+
+	for (size_t d = 0U; d < docs->ndoc; d++) {
+		memcpy(h + d * nh, m->hbias, nh * sizeof(*h));
+	}
+#define w(i)		(w + i * ld * el_size(et))
+	for (size_t t = 0U, o = 0U; t < nt; t++) {
+		/* offsets have moved on to the end of their term */
+		const size_t e = tc[trm[t]];
+
+		for (; o < e; o++) {
+			el_saxpy(nh, ev[o], w(trm[t]), et, h + ed[o] * nh);
+		}
+		tc[trm[t]] = 0U;
+	}
+#undef w
+	free(trm);
+	free(ed);
+	free(ev);
+	return 0;
+}
+
+static void
+expt_up(drbctx_t ctx, float *restrict h)
+{
+/* propagate CTX's visible layer vo up, hidden expectations go to H,
+ * int8 weights want the visible layer as uint8 */
+	const dl_rbm_t m = ctx->m;
+
+	if (ctx->vq != NULL) {
+		const float *r = ((const struct dl_rbm_priv_s*)m->priv)->q8s;
+
+		quant_vis(ctx->vq, &ctx->vqs, ctx->vo, r, m->nvis);
+		prop_up_q8(h, m, ctx->vq, ctx->vqs);
+	} else {
+		prop_up(h, m, ctx->vo);
+	}
+	expt_hid(h, m, h);
+	return;
+}
+
+/* output formats of prop and serve */
+typedef enum {
+	OFMT_UNK,
+	/* a line per unit, or per firing unit when sampling */
+	OFMT_TEXT,
+	/* binary formats, one row per document,
+	 * little-endian binary32 */
+	OFMT_F32,
+	/* little-endian binary16 */
+	OFMT_F16,
+	/* probabilities times 255 */
+	OFMT_U8,
+	/* samples, a bit per unit, lsb first, rows padded to bytes */
+	OFMT_BITS,
+	NOFMTS,
+} ofmt_t;
+
+/* stdio buffer for binary formats */
+#define OFMT_BUFZ	(1U << 20U)
+
+static const char *const ofmt_names[NOFMTS] = {
+	[OFMT_TEXT] = "text",
+	[OFMT_F32] = "f32",
+	[OFMT_F16] = "f16",
+	[OFMT_U8] = "u8",
+	[OFMT_BITS] = "bits",
+};
+
+static void
+wr_hid(FILE *out, const float *h, size_t nh, ofmt_t of)
+{
+/* write hidden layer H as a row of binary format OF to OUT,
+ * a chunk at a time so stdio can hand them over in large writes */
+	union {
+		uint32_t u[1024U];
+		h16_t s[2048U];
+		uint8_t b[4096U];
+	} buf;
+
+	for (size_t j = 0U, n; j < nh; j += n) {
+		const size_t nr = nh - j;
+
+		switch (of) {
+		case OFMT_F32:
+			n = nr < countof(buf.u) ? nr : countof(buf.u);
+			for (size_t k = 0U; k < n; k++) {
+				uint32_t u;
+
+				memcpy(&u, h + j + k, sizeof(u));
+				buf.u[k] = htole32(u);
+			}
+			fwrite(buf.u, sizeof(*buf.u), n, out);
+			break;
+		case OFMT_F16:
+			n = nr < countof(buf.s) ? nr : countof(buf.s);
+			for (size_t k = 0U; k < n; k++) {
+				buf.s[k] = htole16(f32_f16(h[j + k], EL_RN));
+			}
+			fwrite(buf.s, sizeof(*buf.s), n, out);
+			break;
+		case OFMT_U8:
+			n = nr < countof(buf.b) ? nr : countof(buf.b);
+			for (size_t k = 0U; k < n; k++) {
+				buf.b[k] = (uint8_t)lrintf(h[j + k] * 255.f);
+			}
+			fwrite(buf.b, sizeof(*buf.b), n, out);
+			break;
+		case OFMT_BITS:
+			/* chunks are multiples of 8 units */
+			n = nr < countof(buf.b) * 8U ? nr : countof(buf.b) * 8U;
+			memset(buf.b, 0, (n + 7U) / 8U);
+			for (size_t k = 0U; k < n; k++) {
+				buf.b[k / 8U] |= (uint8_t)(
+					(h[j + k] > 0.f) << (k % 8U));
+			}
+			fwrite(buf.b, sizeof(*buf.b), (n + 7U) / 8U, out);
+			break;
+		default:
+			return;
+		}
+	}
+	return;
+}
+
+static inline size_t
+unit_id(drbctx_t ctx, size_t j)
+{
+/* return the id of CTX's hidden unit J in the machine it came from */
+	return ctx->unit != NULL ? ctx->unit[j] : j;
+}
+
+static size_t
+out_smpl(drbctx_t ctx, const float *h, size_t ns, ofmt_t of, FILE *out)
+{
+/* draw NS samples from hidden expectations H and print them to OUT
+ * in format OF, in text every sample ends in a form feed line,
+ * return the number of lines printed, 0 for binary formats */
+	const size_t nh = ctx->m->nhid;
+	const uint8_t *sb = ctx->sbit;
+	unsigned int *restrict t = ctx->sthr;
+	size_t res = 0U;
+
+	/* fixed-point the probabilities once, they're the same for all */
+	for (size_t j = 0U; j < nh; j++) {
+		t[j] = h[j] < 1.f ? (unsigned int)(h[j] * 0x1p32f) : UINT_MAX;
+	}
+	for (size_t s = 0U; s < ns; s++) {
+		dr_rand_int_n(ctx->sunf, nh);
+		smpl_bits(ctx->sbit, t, ctx->sunf, nh);
+
+		switch (of) {
+		case OFMT_BITS:
+			fwrite(sb, sizeof(*sb), (nh + 7U) / 8U, out);
+			break;
+		case OFMT_TEXT:
+			for (size_t j = 0U; j < nh; j++) {
+				if (sb[j / 8U] >> (j % 8U) & 1U) {
+					fprintf(out, "%zu\t1\n",
+						unit_id(ctx, j));
+					res++;
+				}
+			}
+			fputs("\f\n", out);
+			res++;
+			break;
+		default:
+			/* widen to the 0/1 floats wr_hid() wants */
+			for (size_t j = 0U; j < nh; j++) {
+				ctx->hr[j] = (float)(sb[j / 8U] >> (j % 8U) & 1U);
+			}
+			wr_hid(out, ctx->hr, nh, of);
+			break;
+		}
+	}
+	return res;
+}
+
+static inline bool
+top_p(drbctx_t ctx)
+{
+/* whether expectations are to be written sparsely, see out_top() */
+	return ctx->topk || ctx->minp > 0.f;
+}
+
+static size_t
+out_top(drbctx_t ctx, const float *h, FILE *out)
+{
+/* print the units of H with a probability of at least CTX->minp, only
+ * the CTX->topk most probable ones if non-0, as ID<TAB>PROB strongest
+ * first, return the number of lines printed */
+	const size_t nh = ctx->m->nhid;
+	const size_t k = ctx->topk && ctx->topk < nh ? ctx->topk : nh;
+	const float minp = ctx->minp;
+	size_t *restrict hp = ctx->hsel;
+	size_t n = 0U;
+	size_t nsel;
+
+	/* restore the min-heap property of HP[0, N) below I */
+	auto void sift(size_t i)
+	{
+		const size_t x = hp[i];
+
+		for (size_t c; (c = 2U * i + 1U) < n; i = c) {
+			c += c + 1U < n && h[hp[c + 1U]] < h[hp[c]];
+			if (!(h[hp[c]] < h[x])) {
+				break;
+			}
+			hp[i] = hp[c];
+		}
+		hp[i] = x;
+		return;
+	}
+
+	for (size_t j = 0U; j < nh; j++) {
+		if (h[j] < minp) {
+			continue;
+		} else if (n < k) {
+			/* heap's not full, bubble J up */
+			size_t i;
+
+			for (i = n++; i && h[j] < h[hp[(i - 1U) / 2U]];
+			     i = (i - 1U) / 2U) {
+				hp[i] = hp[(i - 1U) / 2U];
+			}
+			hp[i] = j;
+		} else if (h[j] > h[hp[0U]]) {
+			/* J beats the weakest of the best k */
+			hp[0U] = j;
+			sift(0U);
+		}
+	}
+	/* heap sort, the weakest goes to the back first */
+	nsel = n;
+	while (n > 1U) {
+		const size_t x = hp[--n];
+
+		hp[n] = hp[0U];
+		hp[0U] = x;
+		sift(0U);
+	}
+	for (size_t i = 0U; i < nsel; i++) {
+		fprintf(out, "%zu\t%g\n", unit_id(ctx, hp[i]), h[hp[i]]);
+	}
+	return nsel;
+}
+
+static size_t
+out_hid(drbctx_t ctx, float *restrict h, size_t ns, ofmt_t of, FILE *out)
+{
+/* print hidden expectations H, or NS samples thereof, to OUT in format OF,
+ * return the number of lines printed, 0 for binary formats */
+	const dl_rbm_t m = ctx->m;
+	const size_t nh = m->nhid;
+	size_t res = 0U;
+
+	if (ns > 1U) {
+		return out_smpl(ctx, h, ns, of, out);
+	} else if (ns) {
+		/* oh, madame wants sampling as well */
+		smpl_hid(h, m, h, ctx_uni(ctx, nh));
+	}
+	if (of != OFMT_TEXT) {
+		wr_hid(out, h, nh, of);
+	} else if (!ns && top_p(ctx)) {
+		res = out_top(ctx, h, out);
+	} else if (!ns) {
+		for (size_t i = 0; i < nh; i++) {
+			fprintf(out, "%g\n", h[i]);
+		}
+		res = nh;
+	} else {
+		for (size_t i = 0U; i < nh; i++) {
+			uint8_t hi = (uint8_t)(int)h[i];
+
+			if (UNLIKELY(hi)) {
+				fprintf(out, "%zu\t%u\n",
+					unit_id(ctx, i), (unsigned int)hi);
+				res++;
+			}
+		}
+	}
+	return res;
+}
+
+static void
+prop_hid(drbctx_t ctx, spsv_t sv)
+{
+/* put the hidden expectations of SV into CTX->ho,
+ * straight from the cache if it's got them */
+	const size_t nh = ctx->m->nhid;
+	float *ce = NULL;
+	uint64_t k;
+	size_t UNUSED(n);
+
+	if (ctx->pc != NULL && (k = pcch_key(ctx->pc, sv))) {
+		bool hitp;
+
+		ce = pcch_get(ctx->pc, k, &hitp);
+		if (hitp) {
+			memcpy(ctx->ho, ce, nh * sizeof(*ctx->ho));
+			return;
+		}
+	}
+
+	/* populate from input */
+	n = popul_sv(ctx->vo, ctx->m->nvis, sv);
+#if defined SALAKHUTDINOV
+	N = n;
+#endif	/* SALAKHUTDINOV */
+
+	/* vh gibbs */
+	expt_up(ctx, ctx->ho);
+	if (ce != NULL) {
+		memcpy(ce, ctx->ho, nh * sizeof(*ce));
+	}
+	return;
+}
+
+static size_t
+prop(drbctx_t ctx, spsv_t sv, size_t ns, ofmt_t of, FILE *out)
+{
+/* propagate SV up and print the hidden layer to OUT in format OF,
+ * return the number of lines printed, 0 for binary formats */
+	prop_hid(ctx, sv);
+	return out_hid(ctx, ctx->ho, ns, of, out);
+}
+
+/* consumer of hidden expectations H, CLO is passed through */
+typedef int (*hid_f)(drbctx_t ctx, float *h, void *clo);
+
+static int
+each_batched(drbctx_t ctx, size_t nb, hid_f fn, void *clo)
+{
+/* propagate all documents on stdin up, NB at a time, see prop_up_csr(),
+ * and hand the hidden expectations of each to FN, in order */
+	const size_t nh = ctx->m->nhid;
+	size_t *ptr = malloc((nb + 1U) * sizeof(*ptr));
+	float *h = malloc(nb * nh * sizeof(*h));
+	size_t *idx = NULL;
+	float *cnt = NULL;
+	size_t zi = 0U;
+	int res = 0;
+
+	if (UNLIKELY(ptr == NULL || h == NULL)) {
+		res = -1;
+		goto out;
+	}
+	/* until a batch comes out short */
+	for (size_t nd = nb; nd == nb;) {
+		/* gather the batch in CSR form */
+		ptr[nd = 0U] = 0U;
+		for (spsv_t sv; nd < nb && (sv = read_tf(STDIN_FILENO)).z;) {
+			const size_t o = ptr[nd];
+
+			if (UNLIKELY(o + sv.z > zi)) {
+				/* extend vectors */
+				zi = 2U * (o + sv.z);
+				idx = realloc(idx, zi * sizeof(*idx));
+				cnt = realloc(cnt, zi * sizeof(*cnt));
+				if (UNLIKELY(idx == NULL || cnt == NULL)) {
+					res = -1;
+					goto out;
+				}
+			}
+			for (size_t k = 0U; k < sv.z; k++) {
+				idx[o + k] = sv.v[k].i;
+				cnt[o + k] = (float)(int)sv.v[k].v;
+			}
+			ptr[++nd] = o + sv.z;
+		}
+
+		with (const rbm_csr_t b = {nd, ptr, idx, cnt}) {
+			if (UNLIKELY(nd && prop_up_csr(h, ctx, &b) < 0)) {
+				res = -1;
+				goto out;
+			}
+		}
+		for (size_t d = 0U; d < nd; d++) {
+			float *restrict hd = h + d * nh;
+
+			expt_hid(hd, ctx->m, hd);
+			if (UNLIKELY(fn(ctx, hd, clo) < 0)) {
+				res = -1;
+				goto out;
+			}
+		}
+	}
+out:
+	free(ptr);
+	free(h);
+	free(idx);
+	free(cnt);
+	return res;
+}
+
+struct out_row_s {
+	size_t ns;
+	ofmt_t of;
+	FILE *out;
+};
+
+static int
+out_row(drbctx_t ctx, float *h, void *clo)
+{
+	const struct out_row_s *o = clo;
+
+	/* sparse records are always framed */
+	if ((out_hid(ctx, h, o->ns, o->of, o->out) && o->ns == 1U) ||
+	    top_p(ctx)) {
+		fputs("\f\n", o->out);
+	}
+	return 0;
+}
+
+static int
+prop_batched(drbctx_t ctx, size_t nb, size_t ns, ofmt_t of, FILE *out)
+{
+/* like prop() but for all documents on stdin, NB at a time */
+	struct out_row_s o = {ns, of, out};
+
+	return each_batched(ctx, nb, out_row, &o);
+}
+
+static int
+each_hid(drbctx_t ctx, size_t nb, hid_f fn, void *clo)
+{
+/* hand the hidden expectations of all documents on stdin to FN, in order,
+ * NB documents at a time unless the weights are int8 */
+	if (nb > 1U && !q8_p(ctx->m)) {
+		return each_batched(ctx, nb, fn, clo);
+	}
+	for (spsv_t sv; (sv = read_tf(STDIN_FILENO)).z;) {
+		prop_hid(ctx, sv);
+		if (UNLIKELY(fn(ctx, ctx->ho, clo) < 0)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+check(dl_rbm_t m)
+{
+	int res = 0;
+
+	with (size_t nv = m->nvis, nh = m->nhid) {
+		for (size_t i = 0; i < nv; i++) {
+			if (UNLIKELY(isnan(m->vbias[i]))) {
+				printf("VBIAS[%zu] <- NAN\n", i);
+				res = 1;
+			}
+		}
+		for (size_t j = 0; j < nh; j++) {
+			if (UNLIKELY(isnan(m->hbias[j]))) {
+				printf("HBIAS[%zu] <- NAN\n", j);
+				res = 1;
+			}
+		}
+		for (size_t i = 0; i < nv; i++) {
+			for (size_t j = 0; j < nh; j++) {
+				if (UNLIKELY(isnan(el_ld(m->w, i * m->ldw + j,
+							 m->etype)))) {
+					printf("W[%zu,%zu] <- NAN\n", i, j);
+					res = 1;
+				}
+			}
+		}
+	}
+	return res;
+}
+
+
+/* library interface, see rbm.h */
+struct rbm_s {
+	dl_rbm_t m;
+};
+
+struct rbm_ctx_s {
+	struct drbctx_s c;
+};
+
+static pthread_once_t rbm_rand_once = PTHREAD_ONCE_INIT;
+/* generator states are per thread, see init_rand_taus() */
+static __thread bool rbm_rand_seedp;
+
+rbm_t
+rbm_open(const char *file, rbm_open_fl_t flags)
+{
+	const int mfl = flags & RBM_OPEN_IN_CORE ? MAP_ANONYMOUS : MAP_SHARED;
+	struct rbm_s *res;
+
+	(void)pthread_once(&rbm_rand_once, init_rand);
+	if (UNLIKELY((res = malloc(sizeof(*res))) == NULL)) {
+		return NULL;
+	} else if (UNLIKELY((res->m = pump_fl(file, O_RDONLY, mfl)) == NULL)) {
+		goto nul;
+	} else if (!q8_p(res->m) && UNLIKELY(wtr_of(res->m) == NULL)) {
+		/* transpose now rather than racing for it in prop_up() */
+		dump(res->m);
+		goto nul;
+	}
+	return res;
+nul:
+	free(res);
+	return NULL;
+}
+
+int
+rbm_close(rbm_t m)
+{
+	int res = dump(m->m);
+
+	free(m);
+	return res;
+}
+
+size_t
+rbm_nvis(rbm_t m)
+{
+	return m->m->nvis;
+}
+
+size_t
+rbm_nhid(rbm_t m)
+{
+	return m->m->nhid;
+}
+
+rbm_ctx_t
+rbm_ctx_new(rbm_t m)
+{
+	struct rbm_ctx_s *res;
+
+	if (UNLIKELY((res = calloc(1, sizeof(*res))) == NULL)) {
+		return NULL;
+	} else if (UNLIKELY(init_drbctx(&res->c, m->m, false) < 0)) {
+		free(res);
+		return NULL;
+	}
+	return res;
+}
+
+void
+rbm_ctx_free(rbm_ctx_t ctx)
+{
+	fini_drbctx(&ctx->c);
+	free(ctx);
+	return;
+}
+
+static int
+prop_csr(drbctx_t ctx, const rbm_csr_t *docs, float *out, bool smplp)
+{
+/* propagate DOCS up, one row of hidden units per document into OUT */
+	const dl_rbm_t m = ctx->m;
+	const size_t nv = m->nvis;
+	const size_t nh = m->nhid;
+
+	if (smplp && UNLIKELY(!rbm_rand_seedp)) {
+		/* first draw on this thread, don't start from the
+		 * default seeds every other thread starts from */
+		init_rand_taus();
+		rbm_rand_seedp = true;
+	}
+	for (size_t d = 0; d < docs->ndoc; d++) {
+		if (UNLIKELY(docs->ptr[d + 1U] < docs->ptr[d])) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (ctx->vq == NULL && UNLIKELY(prop_up_csr(out, ctx, docs) < 0)) {
+		return -1;
+	}
+	for (size_t d = 0; d < docs->ndoc; d++) {
+		const size_t o = docs->ptr[d];
+		float *restrict h = out + d * nh;
+
+		if (ctx->vq != NULL) {
+			/* int8 weights are hidden-major, no batching */
+			(void)popul_sp(ctx->vo, nv, docs->idx + o,
+				       docs->cnt + o, docs->ptr[d + 1U] - o);
+			expt_up(ctx, h);
+		} else {
+			expt_hid(h, m, h);
+		}
+		if (smplp) {
+			smpl_hid(h, m, h, NULL);
+		}
+	}
+	return 0;
+}
+
+int
+rbm_prop_batch(rbm_ctx_t ctx, const rbm_csr_t *docs, float *out)
+{
+	return prop_csr(&ctx->c, docs, out, false);
+}
+
+int
+rbm_smpl_batch(rbm_ctx_t ctx, const rbm_csr_t *docs, float *out)
+{
+	return prop_csr(&ctx->c, docs, out, true);
+}
+
+
+
+#if !defined LIBRBM
+#if defined __INTEL_COMPILER
+# pragma warning (disable:593)
+# pragma warning (disable:181)
+#endif	/* __INTEL_COMPILER */
+#include "rbm.xh"
+#include "rbm.x"
+#if defined __INTEL_COMPILER
+# pragma warning (default:593)
+# pragma warning (default:181)
+#endif	/* __INTEL_COMPILER */
+
+static int
+rd_spec(struct dl_spec_s *restrict tgt, const char *str)
+{
+/* parse VISxHID in STR into TGT */
+	char *chk;
 
-	DEBUG(dump_layer("Ve", vis, nvis));
+	tgt->nvis = strtoul(str, &chk, 0);
+	if ((*chk++ | 0x20) != 'x') {
+		return -1;
+	}
+	tgt->nhid = strtoul(chk, &chk, 0);
+	if (*chk) {
+		return -1;
+	}
+	return 0;
+}
 
-	/* vis is expected to contain the lambda values */
-	for (size_t i = 0; i < nvis; i++) {
-#if !defined BINOM_INPUT
-		v[i] = dr_rand_poiss(vis[i]);
-#else  /* BINOM_INPUT */
-		v[i] = dr_rand_binom1(vis[i]);
-#endif	/* !BINOM_INPUT */
+static dl_etype_t
+rd_etype(const char *str)
+{
+/* return the element type named STR, DL_ET_UNK if there's none */
+	for (dl_etype_t et = DL_ET_F32; et < DL_NETS; et++) {
+		if (!strcmp(str, etype_names[et])) {
+			return et;
+		}
+	}
+	return DL_ET_UNK;
+}
+
+static size_t*
+rd_units(const char *str, size_t nh, size_t *restrict n)
+{
+/* read a list of hidden units like 0-99,200,4000-4095 off STR, return
+ * its *N ids in order, or NULL unless STR is such a list of ids < NH */
+	size_t *res = NULL;
+	size_t nr = 0U;
+	size_t zr = 0U;
+
+	for (const char *p = str;; p++) {
+		char *e;
+		size_t lo;
+		size_t hi;
+
+		lo = hi = strtoul(p, &e, 10);
+		if (e == p || *p == '-') {
+			goto bad;
+		} else if (*e == '-') {
+			p = e + 1U;
+			hi = strtoul(p, &e, 10);
+			if (e == p || *p == '-') {
+				goto bad;
+			}
+		}
+		if ((*e && *e != ',') || lo > hi || hi >= nh) {
+			goto bad;
+		}
+		if (nr + (hi - lo + 1U) > zr) {
+			/* resize */
+			size_t *nu;
+
+			zr = 2U * (nr + (hi - lo + 1U));
+			if (UNLIKELY((nu = realloc(res, zr * sizeof(*nu))) == NULL)) {
+				goto bad;
+			}
+			res = nu;
+		}
+		for (size_t j = lo; j <= hi; j++) {
+			res[nr++] = j;
+		}
+		if (!*(p = e)) {
+			break;
+		}
+	}
+	*n = nr;
+	return res;
+bad:
+	free(res);
+	return NULL;
+}
+
+static ofmt_t
+rd_ofmt(const char *str)
+{
+/* return the output format named STR, OFMT_UNK if there's none */
+	for (ofmt_t of = OFMT_TEXT; of < NOFMTS; of++) {
+		if (!strcmp(str, ofmt_names[of])) {
+			return of;
+		}
+	}
+	return OFMT_UNK;
+}
+
+static int
+cmd_init(struct glod_args_info argi[static 1])
+{
+/* shell return codes, 0 success, 1 failure */
+	const char *file = argi->inputs[1U];
+	const uint64_t flags = argi->transposed_given ? DL_FL_WTR : DL_FL_NONE;
+	struct dl_spec_s dim;
+	struct dl_spec_s cap = {0U, 0U};
+	/* resizing keeps the element type unless told otherwise */
+	dl_etype_t et = argi->resize_given ? DL_ET_UNK : DL_ET_F32;
+	dl_rbm_t m;
+	int res = 0;
+
+	/* parse dimens */
+	if (rd_spec(&dim, argi->dimen_arg) < 0) {
+		res = 1;
+		goto out;
+	} else if (argi->capacity_given &&
+		   rd_spec(&cap, argi->capacity_arg) < 0) {
+		res = 1;
+		goto out;
+	} else if (argi->element_type_given &&
+		   (et = rd_etype(argi->element_type_arg)) == DL_ET_UNK) {
+		fprintf(stderr, "\
+unknown element type `%s'\n", argi->element_type_arg);
+		res = 1;
+		goto out;
+	}
+
+	/* just create (or resize) the machine */
+	init_rand();
+	if (argi->inputs_num < 2) {
+		fputs("no machine file given\n", stderr);
+		res = 1;
+	} else if (!argi->resize_given && (m = crea(file, dim, cap, flags, et)) == NULL) {
+		fprintf(stderr, "error creating machine file `%s'\n", file);
+		res = 1;
+	} else if (argi->resize_given && (m = pump(file, O_RDWR)) == NULL) {
+		fprintf(stderr, "error loading machine file `%s'\n", file);
+		res = 1;
+	} else if (argi->resize_given && resz(m, dim, cap, flags, et) < 0) {
+		/* actually do resize now (in --resize mode) */
+		res = 1;
+	} else {
+		/* for both cases, write the file to disk */
+		res = dump(m);
+	}
+	deinit_rand();
+out:
+	return res;
+}
+
+static int
+cmd_train(struct glod_args_info argi[static 1])
+{
+	static jmp_buf jb;
+	const char *file = argi->inputs[1U];
+	/* checkpoint every that many batches, 0 for never */
+	const size_t ckptn = argi->checkpoint_every_given
+		? (size_t)argi->checkpoint_every_arg : 0U;
+	/* train on a copy and write it out via ckpt_sync() at the end */
+	const bool cowp = ckptn || argi->in_core_given || argi->journal_given;
+	/* map it privately or read the whole thing into memory */
+	const int mfl = argi->in_core_given ? MAP_ANONYMOUS : MAP_PRIVATE;
+	/* checkpoint into the journal */
+	const bool jnlp = argi->journal_given;
+	dl_rbm_t m = NULL;
+	/* set after C-c, so keep it out of registers */
+	volatile int res = 0;
+
+	if (argi->inputs_num < 2) {
+		fputs("no machine file given\n", stderr);
+		res = 1;
+
+	} else if (argi->checkpoint_every_given &&
+		   argi->checkpoint_every_arg <= 0) {
+		fputs("checkpoint interval must be positive\n", stderr);
+		res = 1;
+
+	} else if (UNLIKELY((m = !cowp
+			     ? pump(file, O_RDWR)
+			     : pump_fl(file, jnlp ? O_RDWR : O_RDONLY,
+				       mfl)) == NULL)) {
+		/* reading the machine file failed */
+		fprintf(stderr, "error opening machine file `%s'\n", file);
+		res = 1;
+
+	} else if (UNLIKELY(wtr_of(m) == NULL)) {
+		fprintf(stderr, "cannot transpose weights of `%s'\n", file);
+		dump(m);
+		res = 1;
+
+	} else if (setjmp(jb)) {
+		/* C-c handler */
+		goto train_xit;
+
+	} else {
+		/* all clear */
+		static struct drbctx_s ctx[1];
+		const int fd = STDIN_FILENO;
+		const size_t batchz = argi->batch_size_arg;
+		size_t i = 0;
+		size_t nb = 0;
+
+		/* set up C-c handling (dirtee) */
+		auto __attribute__((noreturn)) void si_train(int UNUSED(sig))
+		{
+			longjmp(jb, 1U);
+		}
+		signal(SIGINT, si_train);
+
+		if (q8_drop(m)) {
+			fprintf(stderr, "\
+int8 weights of `%s' dropped, quantize again after training\n", file);
+		}
+		init_rand();
+		if (UNLIKELY(init_drbctx(ctx, m, true) < 0)) {
+			fputs("cannot allocate training buffers\n", stderr);
+			res = 1;
+			goto train_out;
+		}
+		if (argi->rng_thread_given) {
+			/* start the generator thread */
+			ctx->rp = make_dr_pool(RP_NLAYERS * m->nhid, 0U);
+		}
+
+		for (spsv_t sv; (sv = read_tf(fd)).z; train(ctx, sv)) {
+			if (++i == batchz) {
+				/* update weights and biasses */
+				final_update_w(ctx);
+				final_update_b(ctx);
+				rset_drbctx(ctx);
+				i = 0U;
+
+				if (ckptn && ++nb % ckptn == 0U &&
+				    UNLIKELY((jnlp
+					      ? ckpt_jnl(ctx, file)
+					      : ckpt(m, file)) < 0)) {
+					fprintf(stderr, "\
+cannot checkpoint to `%s'\n", file);
+				}
+			}
+		}
+	train_xit:
+		/* also hopped to by the signal handler */
+		final_update_w(ctx);
+		final_update_b(ctx);
+
+		if (jnlp && UNLIKELY(ckpt_jnl(ctx, file) < 0)) {
+			fprintf(stderr, "cannot journal machine to `%s'\n", file);
+			res = 1;
+		} else if (!jnlp && (ckptn || argi->in_core_given) &&
+			   UNLIKELY(ckpt_sync(m, file) < 0)) {
+			fprintf(stderr, "cannot write machine to `%s'\n", file);
+			res = 1;
+		}
+
+	train_out:
+		/* just to deinitialise resources */
+		(void)read_tf(-1);
+		fini_drbctx(ctx);
+		dump(m);
+		deinit_rand();
+	}
+	return res;
+}
+
+static int
+cmd_prop(struct glod_args_info argi[static 1])
+{
+	static jmp_buf jb;
+	const char *file = argi->inputs[1U];
+	const int mfl = argi->in_core_given ? MAP_ANONYMOUS : MAP_SHARED;
+	const ofmt_t of = rd_ofmt(argi->output_format_arg);
+	dl_rbm_t m = NULL;
+	/* units to propagate, if not all, and the machine of just those */
+	size_t *volatile u = NULL;
+	size_t nu = 0U;
+	dl_rbm_t volatile um = NULL;
+	volatile int res = 0;
+
+	if (UNLIKELY(of == OFMT_UNK)) {
+		fprintf(stderr, "unknown output format `%s'\n",
+			argi->output_format_arg);
+		return 1;
+	}
+	if (UNLIKELY((argi->top_k_given || argi->min_prob_given) &&
+		     (of != OFMT_TEXT ||
+		      argi->sample_given || argi->samples_given))) {
+		fputs("\
+--top-k and --min-prob need text output of expectations\n", stderr);
+		return 1;
+	}
+	if (UNLIKELY(argi->cache_given && argi->cache_arg > 0 &&
+		     argi->batch_given && argi->batch_arg > 1)) {
+		fputs("\
+--cache propagates one document at a time, drop --batch\n", stderr);
+		return 1;
+	}
+
+	if (argi->inputs_num < 2) {
+		fputs("no machine file given\n", stderr);
+		res = 1;
+
+	} else if (UNLIKELY((m = pump_fl(file, O_RDONLY, mfl)) == NULL)) {
+		/* reading the machine file failed */
+		fprintf(stderr, "error opening machine file `%s'\n", file);
+		res = 1;
+
+	} else if (argi->units_given &&
+		   UNLIKELY((u = rd_units(argi->units_arg,
+					  m->nhid, &nu)) == NULL)) {
+		fprintf(stderr, "invalid unit list `%s'\n", argi->units_arg);
+		dump(m);
+		res = 1;
+
+	} else if (u != NULL && UNLIKELY((um = sub_rbm(m, u, nu)) == NULL)) {
+		fputs("cannot gather hidden units\n", stderr);
+		free(u);
+		dump(m);
+		res = 1;
+
+	} else if (um == NULL && !q8_p(m) && UNLIKELY(wtr_of(m) == NULL)) {
+		/* int8 weights are transposed already, as are units */
+		fprintf(stderr, "cannot transpose weights of `%s'\n", file);
+		dump(m);
+		res = 1;
+
+	} else if (setjmp(jb)) {
+		/* C-c handler */
+		goto prop_xit;
+
+	} else {
+		/* all clear */
+		static struct drbctx_s ctx[1];
+		const int fd = STDIN_FILENO;
+		const size_t nb = argi->batch_arg > 0
+			? (size_t)argi->batch_arg : 1U;
+		/* packed bits only make sense for samples */
+		const size_t ns = argi->samples_given && argi->samples_arg > 0
+			? (size_t)argi->samples_arg
+			: argi->sample_given || of == OFMT_BITS;
+
+		/* set up the C-c handler */
+		auto __attribute__((noreturn)) void si_prop(int UNUSED(sig))
+		{
+			longjmp(jb, 2U);
+		}
+		signal(SIGINT, si_prop);
+
+		init_rand();
+		if (UNLIKELY(init_drbctx(ctx, um ?: m, false) < 0)) {
+			fputs("cannot allocate scratch vectors\n", stderr);
+			res = 1;
+			goto prop_xit;
+		}
+		ctx->unit = u;
+		ctx->topk = argi->top_k_given && argi->top_k_arg > 0
+			? (size_t)argi->top_k_arg : 0U;
+		ctx->minp = argi->min_prob_given ? argi->min_prob_arg : 0.f;
+		if (argi->cache_given && argi->cache_arg > 0 &&
+		    UNLIKELY((ctx->pc = make_pcch(
+				      (size_t)argi->cache_arg,
+				      ctx->m->nhid)) == NULL)) {
+			fputs("cannot allocate cache, going without\n", stderr);
+		}
+		if (of != OFMT_TEXT) {
+			/* rows go out in large writes */
+			setvbuf(stdout, NULL, _IOFBF, OFMT_BUFZ);
+		}
+
+		if (nb > 1U && !q8_p(m) && ctx->pc == NULL) {
+			/* int8 weights are hidden-major, no batching,
+			 * and cached documents go one at a time */
+			if (prop_batched(ctx, nb, ns, of, stdout) < 0) {
+				perror("cannot prop");
+				res = 1;
+			}
+		} else for (spsv_t sv; (sv = read_tf(fd)).z;) {
+			if ((prop(ctx, sv, ns, of, stdout) && ns == 1U) ||
+			    top_p(ctx)) {
+				puts("\f");
+			}
+		}
+
+	prop_xit:
+		if (ctx->pc != NULL && argi->verbose_given) {
+			pcch_prnt(ctx->pc, stderr);
+		}
+		/* just to deinitialise resources */
+		(void)read_tf(-1);
+		fini_drbctx(ctx);
+		dump(um);
+		free(u);
+		dump(m);
+		deinit_rand();
+	}
+
+	return res;
+}
+
+/* serving, documents come in over a unix socket in the same format
+ * prop reads them, each answer is what prop would print followed by
+ * a form feed line */
+#define SERVE_SFX	".sock"
+/* events to pick up per epoll_wait() */
+#define SERVE_NEV	(64U)
+/* clients sending more than this without ending a document are cut */
+#define SERVE_MAXIB	(64UL << 20U)
+/* clients not reading their answers aren't read from beyond this */
+#define SERVE_MAXOB	(64UL << 20U)
+/* read at most this much off a connection per round */
+#define SERVE_RDZ	(256UL << 10U)
+/* documents per batch unless --batch says otherwise */
+#define SERVE_NB	(64U)
+
+struct conn_s {
+	int fd;
+	/* client hung up, close once the output is out */
+	bool eof;
+	/* reading failed, close once the output is out */
+	bool err;
+	/* events we're polling for */
+	uint32_t evs;
+	/* input so far, ends in an incomplete document */
+	char *ib;
+	size_t ibz;
+	size_t ibn;
+	/* answers, OB is owned by the memstream OF,
+	 * OBO is how much of it has been written */
+	FILE *of;
+	char *ob;
+	size_t obz;
+	size_t obo;
+};
+
+static volatile sig_atomic_t serve_quit;
+static volatile sig_atomic_t serve_stat;
+
+static void
+serve_sig(int UNUSED(sig))
+{
+	serve_quit = 1;
+	return;
+}
+
+static void
+serve_usr(int UNUSED(sig))
+{
+	serve_stat = 1;
+	return;
+}
+
+static struct conn_s*
+conn_new(int fd)
+{
+	struct conn_s *res;
+
+	if (UNLIKELY((res = calloc(1, sizeof(*res))) == NULL)) {
+		return NULL;
+	} else if (UNLIKELY((res->of = open_memstream(
+				     &res->ob, &res->obz)) == NULL)) {
+		free(res);
+		return NULL;
+	}
+	res->fd = fd;
+	res->evs = EPOLLIN;
+	return res;
+}
+
+static void
+conn_free(struct conn_s *c)
+{
+	close(c->fd);
+	fclose(c->of);
+	free(c->ob);
+	free(c->ib);
+	free(c);
+	return;
+}
+
+static int
+conn_rd(struct conn_s *restrict c)
+{
+/* slurp what there is to read on C, up to SERVE_RDZ bytes so that
+ * clients keep their turns short, return -1 on errors or overlong
+ * documents */
+	for (const size_t ibn = c->ibn; c->ibn - ibn < SERVE_RDZ;) {
+		ssize_t nrd;
+
+		if (UNLIKELY(c->ibn + 4096U > c->ibz)) {
+			/* extend buffer */
+			size_t nu = c->ibz * 2U ?: 16384U;
+			char *ib;
+
+			if (UNLIKELY(nu > SERVE_MAXIB)) {
+				return -1;
+			} else if (UNLIKELY((ib = realloc(c->ib, nu)) == NULL)) {
+				return -1;
+			}
+			c->ib = ib;
+			c->ibz = nu;
+		}
+		nrd = read(c->fd, c->ib + c->ibn, c->ibz - c->ibn);
+		if (nrd > 0) {
+			c->ibn += nrd;
+		} else if (nrd == 0) {
+			c->eof = true;
+			break;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* documents gathered from all connections ready at once, in CSR form,
+ * and the connection each one came from */
+struct serve_bat_s {
+	size_t nb;
+	size_t nd;
+	size_t *ptr;
+	size_t *idx;
+	float *cnt;
+	size_t zi;
+	struct conn_s **dc;
+	/* hidden expectations, nb rows */
+	float *h;
+};
+
+static int
+bat_flush(drbctx_t ctx, struct serve_bat_s *restrict b, size_t ns, ofmt_t of)
+{
+/* answer the documents in B in one go, see prop_up_csr(),
+ * each answer goes to the connection its document came from */
+	const size_t nh = ctx->m->nhid;
+
+	with (const rbm_csr_t d = {b->nd, b->ptr, b->idx, b->cnt}) {
+		if (UNLIKELY(b->nd && prop_up_csr(b->h, ctx, &d) < 0)) {
+			return -1;
+		}
 	}
+	for (size_t d = 0U; d < b->nd; d++) {
+		float *restrict hd = b->h + d * nh;
 
-	DEBUG(dump_layer("Vs", vis, nvis));
+		expt_hid(hd, ctx->m, hd);
+		out_hid(ctx, hd, ns, of, b->dc[d]->of);
+		if (of == OFMT_TEXT && ns <= 1U) {
+			fputs("\f\n", b->dc[d]->of);
+		}
+	}
+	b->nd = 0U;
 	return 0;
 }
 
-
-/* training and classifying modes */
-typedef struct drbctx_s *drbctx_t;
-
-struct drbctx_s {
-	dl_rbm_t m;
-
-	/* some scratch vectors for the gibbs sampling */
-	float *vo;
-	float *ho;
-	float *vr;
-	float *hr;
+static int
+bat_add(
+	drbctx_t ctx, struct serve_bat_s *restrict b, struct conn_s *c,
+	spsv_t sv, size_t ns, ofmt_t of)
+{
+/* add document SV from C to B, answer the batch once it's full */
+	const size_t o = b->ptr[b->nd];
 
-	/* difference vectors */
-	float *dh;
-	float *dv;
-	float *dw;
-};
+	if (UNLIKELY(o + sv.z > b->zi)) {
+		/* extend vectors */
+		size_t nu = 2U * (o + sv.z);
+		size_t *idx;
+		float *cnt;
 
-static const float eta = 0.02f;
-static const float mom = 0.9f;
-static const float dec = 0.f;
+		if (UNLIKELY((idx = realloc(b->idx, nu * sizeof(*idx))) == NULL)) {
+			return -1;
+		}
+		b->idx = idx;
+		if (UNLIKELY((cnt = realloc(b->cnt, nu * sizeof(*cnt))) == NULL)) {
+			return -1;
+		}
+		b->cnt = cnt;
+		b->zi = nu;
+	}
+	for (size_t k = 0U; k < sv.z; k++) {
+		b->idx[o + k] = sv.v[k].i;
+		b->cnt[o + k] = (float)(int)sv.v[k].v;
+	}
+	b->dc[b->nd] = c;
+	b->ptr[++b->nd] = o + sv.z;
+	if (b->nd >= b->nb) {
+		return bat_flush(ctx, b, ns, of);
+	}
+	return 0;
+}
 
-static void
-init_drbctx(struct drbctx_s *restrict tgt, dl_rbm_t m)
+static int
+conn_docs(
+	drbctx_t ctx, struct conn_s *restrict c, size_t ns, ofmt_t of,
+	spsv_t *scr, struct serve_bat_s *bt)
 {
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
+/* answer all complete documents in C's input in format OF, SCR is
+ * scratch space for the sparse vectors, SCR->z being its capacity,
+ * documents go to batch BT, or are answered right away without one,
+ * return the number of documents taken, -1 on errors */
+	int nd = 0;
+	size_t o = 0U;
+
+	while (o < c->ibn) {
+		const char *b = c->ib + o;
+		const char *eod;
+		const char *eol;
+		size_t n = 0U;
+
+		/* find the form feed line that ends the document */
+		if (*b == '\f') {
+			eod = b;
+		} else if ((eod = memmem(b, c->ibn - o, "\n\f", 2U)) != NULL) {
+			eod++;
+		} else {
+			break;
+		}
+		if ((eol = memchr(eod, '\n', c->ib + c->ibn - eod)) == NULL) {
+			break;
+		}
 
-	tgt->m = m;
+		/* all lines before EOD end in a newline */
+		for (const char *nl; b < eod; b = nl + 1U) {
+			nl = memchr(b, '\n', eod - b);
 
-	/* initialise the scratch vectors */
-	tgt->vo = calloc(nv, sizeof(*tgt->vo));
-	tgt->vr = calloc(nv, sizeof(*tgt->vr));
-	tgt->ho = calloc(nh, sizeof(*tgt->ho));
-	tgt->hr = calloc(nh, sizeof(*tgt->hr));
+			if (UNLIKELY(n >= scr->z)) {
+				/* extend vector */
+				const size_t nu = scr->z + 256U;
+				spsc_t *v = realloc(scr->v, nu * sizeof(*v));
 
-	tgt->dw = calloc(nh * nv, sizeof(*tgt->dw));
-	tgt->dh = calloc(nh, sizeof(*tgt->dh));
-	tgt->dv = calloc(nv, sizeof(*tgt->dv));
-	return;
+				if (UNLIKELY(v == NULL)) {
+					return -1;
+				}
+				scr->v = v;
+				scr->z = nu;
+			}
+			if (snarf_tf(scr->v + n, b, nl) == 0) {
+				n++;
+			}
+		}
+		with (spsv_t sv = {.z = n, .v = scr->v}) {
+			if (bt != NULL && bat_add(ctx, bt, c, sv, ns, of) < 0) {
+				return -1;
+			} else if (bt == NULL) {
+				prop(ctx, sv, ns, of, c->of);
+				if (of == OFMT_TEXT && ns <= 1U) {
+					/* binary answers are of fixed size,
+					 * multiple samples come with a form
+					 * feed each */
+					fputs("\f\n", c->of);
+				}
+			}
+		}
+		o = eol + 1U - c->ib;
+		nd++;
+	}
+	/* keep the incomplete rest */
+	memmove(c->ib, c->ib + o, c->ibn -= o);
+	return nd;
 }
 
-static void
-fini_drbctx(struct drbctx_s *tgt)
+static int
+conn_wr(struct conn_s *restrict c)
 {
-	tgt->m = NULL;
-
-	free(tgt->vo);
-	free(tgt->vr);
-	free(tgt->ho);
-	free(tgt->hr);
-
-	free(tgt->dw);
-	free(tgt->dv);
-	free(tgt->dh);
-	return;
+/* write as many answers as C will take,
+ * return 1 if some are left over, -1 on errors */
+	fflush(c->of);
+	while (c->obo < c->obz) {
+		ssize_t nwr = send(c->fd, c->ob + c->obo, c->obz - c->obo,
+				   MSG_NOSIGNAL);
+
+		if (nwr >= 0) {
+			c->obo += nwr;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 1;
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+	/* all out, rewind the memstream */
+	fseeko(c->of, 0, SEEK_SET);
+	c->obo = 0U;
+	return 0;
 }
 
-static void
-rset_drbctx(struct drbctx_s *tgt)
+static int
+serve_sock(const char *file)
 {
-	const size_t nv = tgt->m->nvis;
-	const size_t nh = tgt->m->nhid;
-
-	memset(tgt->dw, 0, nv * nh);
-	memset(tgt->dv, 0, nv);
-	memset(tgt->dh, 0, nh);
-	return;
+/* return a listening socket bound to FILE.sock, unlink a stale one */
+	struct sockaddr_un sa = {.sun_family = AF_UNIX};
+	const int fl = SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC;
+	struct stat st;
+	int s;
+
+	if (UNLIKELY((size_t)snprintf(
+			     sa.sun_path, sizeof(sa.sun_path),
+			     "%s" SERVE_SFX, file) >= sizeof(sa.sun_path))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	} else if ((s = socket(AF_UNIX, fl, 0)) < 0) {
+		return -1;
+	}
+	if (stat(sa.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		/* see if someone's serving there already */
+		int t = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (t >= 0 && connect(t, (void*)&sa, sizeof(sa)) == 0) {
+			close(t);
+			close(s);
+			errno = EADDRINUSE;
+			return -1;
+		} else if (t >= 0) {
+			close(t);
+		}
+		(void)unlink(sa.sun_path);
+	}
+	if (bind(s, (void*)&sa, sizeof(sa)) < 0 ||
+	    listen(s, SOMAXCONN) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
 }
 
-#if defined __SSE__ && defined DEFER_UPDATES && 0
-/* this version is slower than the sequential one */
-static ni void
-sse_update_w(drbctx_t ctx)
+static int
+serve(drbctx_t ctx, int s, size_t ns, ofmt_t of, size_t nb)
 {
-#define f4z		sizeof(float) * 4U
-	typedef float f4 __attribute__((aligned(f4z), vector_size(f4z)));
-	dl_rbm_t m = ctx->m;
-	const float *vo = ctx->vo;
-	const float *ho = ctx->ho;
-	const float *vr = ctx->vr;
-	const float *hr = ctx->hr;
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
-	float *restrict dw = ctx->dw;
-	const float *w = m->w;
-#if !defined NDEBUG
-	float mind = INFINITY;
-	float maxd = -INFINITY;
-#endif	/* !NDEBUG */
+/* answer documents coming in on listening socket S till C-c, documents
+ * arriving together on any connections are answered in batches of up to
+ * NB, unless that's 1, the weights are int8 or there's a cache */
+	const size_t nh = ctx->m->nhid;
+	struct epoll_event ev[SERVE_NEV];
+	spsv_t scr = {.z = 0U, .v = NULL};
+	struct serve_bat_s bat = {.nb = nb};
+	struct serve_bat_s *bt = NULL;
+	int res = 0;
+	int ep;
+
+	if (nb > 1U && !q8_p(ctx->m) && ctx->pc == NULL) {
+		bat.ptr = calloc(nb + 1U, sizeof(*bat.ptr));
+		bat.dc = calloc(nb, sizeof(*bat.dc));
+		bat.h = malloc(nb * nh * sizeof(*bat.h));
+		if (UNLIKELY(bat.ptr == NULL || bat.dc == NULL || bat.h == NULL)) {
+			res = -1;
+			goto out;
+		}
+		bt = &bat;
+	}
+	if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		res = -1;
+		goto out;
+	}
+	ev->events = EPOLLIN;
+	ev->data.ptr = NULL;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, s, ev) < 0) {
+		res = -1;
+		goto clo;
+	}
 
-#define w(i, j)		(w + i * nh + j)
-#define dw(i, j)	(dw + i * nh + j)
+	auto void acc(void)
+	{
+		for (int fd; (fd = accept4(
+				      s, NULL, NULL,
+				      SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+			struct epoll_event e = {.events = EPOLLIN};
+
+			if (UNLIKELY((e.data.ptr = conn_new(fd)) == NULL)) {
+				close(fd);
+			} else if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e) < 0) {
+				conn_free(e.data.ptr);
+			}
+		}
+		return;
+	}
 
-	/* bang <v_i h_j> into weights */
-	for (size_t i = 0; i < nv; i++) {
-		for (size_t j = 0; j < nh; j += 4U) {
-			const f4 vo4 = {vo[i], vo[i], vo[i], vo[i]};
-			const f4 ho4 = *(const f4*)(ho + j);
-			const f4 vr4 = {vr[i], vr[i], vr[i], vr[i]};
-			const f4 hr4 = *(const f4*)(hr + j);
-			const f4 vho4 = vo4 * ho4;
-			const f4 vhr4 = vr4 * hr4;
-			f4 d = vho4 - vhr4;
-			static const f4 dec4 = {0.f, 0.f, 0.f, 0.f};
-			static const f4 eta4 = {0.02f, 0.02f, 0.02f, 0.02f};
-			static const f4 mom4 = {0.9f, 0.9f, 0.9f, 0.9f};
+	auto int rd(struct conn_s *c, uint32_t evs)
+	{
+		if ((evs & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c->eof) {
+			c->err = conn_rd(c) < 0;
+			return conn_docs(ctx, c, ns, of, &scr, bt);
+		}
+		return 0;
+	}
 
-			/* decay */
-			d -= dec4 * *(const f4*)w(i, j);
-			/* learning rate */
-			d *= eta4;
-			/* momentum term */
-			d += mom4 * *(const f4*)dw(i, j);
+	auto void wr(struct conn_s *c)
+	{
+		int rc = c->err ? -1 : conn_wr(c);
 
-#if !defined NDEBUG && 0
-			if (d < mind) {
-				mind = d;
+		if (rc < 0 || (rc == 0 && c->eof)) {
+			/* closing the fd takes it out of the epoll set */
+			conn_free(c);
+		} else {
+			/* poll for what's outstanding, clients sitting
+			 * on their answers don't get to send more */
+			const bool inp = !c->eof &&
+				c->obz - c->obo < SERVE_MAXOB;
+			struct epoll_event e = {
+				.events = (inp ? EPOLLIN : 0U) |
+				(rc > 0 ? EPOLLOUT : 0U),
+				.data.ptr = c,
+			};
+
+			if (e.events != c->evs) {
+				c->evs = e.events;
+				(void)epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &e);
 			}
-			if (d > maxd) {
-				maxd = d;
+		}
+		return;
+	}
+
+	while (!serve_quit) {
+		int nev = epoll_wait(ep, ev, countof(ev), -1);
+
+		if (UNLIKELY(serve_stat)) {
+			/* SIGUSR1, tell them about the cache */
+			serve_stat = 0;
+			if (ctx->pc != NULL) {
+				pcch_prnt(ctx->pc, stderr);
+			}
+		}
+		/* gather the documents of all ready connections first */
+		for (int i = 0; i < nev; i++) {
+			if (ev[i].data.ptr == NULL) {
+				acc();
+			} else if (UNLIKELY(rd(ev[i].data.ptr,
+					       ev[i].events) < 0)) {
+				res = -1;
+				goto clo;
+			}
+		}
+		/* answer the rest, then everything leaves in one write
+		 * per connection */
+		if (bt != NULL && UNLIKELY(bat_flush(ctx, bt, ns, of) < 0)) {
+			res = -1;
+			goto clo;
+		}
+		for (int i = 0; i < nev; i++) {
+			if (ev[i].data.ptr != NULL) {
+				wr(ev[i].data.ptr);
 			}
-#endif	/* !NDEBUG */
-			*(f4*)dw(i, j) = d;
 		}
 	}
-#if !defined NDEBUG
-	printf("dw (%.6g  %.6g)\n", mind, maxd);
-#endif	/* !NDEBUG */
-#undef w
-#undef dw
-	return;
+
+	/* connections still open are left to the kernel */
+clo:
+	close(ep);
+out:
+	free(scr.v);
+	free(bat.ptr);
+	free(bat.idx);
+	free(bat.cnt);
+	free(bat.dc);
+	free(bat.h);
+	return res;
 }
-#endif	/* __SSE__ */
 
-static ni void
-update_w(drbctx_t ctx)
+static int
+cmd_serve(struct glod_args_info argi[static 1])
 {
-	dl_rbm_t m = ctx->m;
-	const struct dl_rbm_priv_s *p = m->priv;
-	const float *vo = ctx->vo;
-	const float *ho = ctx->ho;
-	const float *vr = ctx->vr;
-	const float *hr = ctx->hr;
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
-	float *restrict dw = ctx->dw;
-#if defined DEFER_UPDATES
-	const float *w = m->w;
-	const float *UNUSED(wtr) = p->wtr;
-#else  /* !DEFER_UPDATES */
-	float *restrict w = m->w;
-	float *restrict wtr = p->wtr;
-#endif	/* DEFER_UPDATES */
-#if !defined NDEBUG
-	float mind = INFINITY;
-	float maxd = -INFINITY;
-#endif	/* !NDEBUG */
+	const char *file = argi->inputs[1U];
+	const int mfl = argi->in_core_given ? MAP_ANONYMOUS : MAP_SHARED;
+	const ofmt_t of = rd_ofmt(argi->output_format_arg);
+	dl_rbm_t m = NULL;
+	/* units to propagate, if not all, and the machine of just those */
+	size_t *u = NULL;
+	size_t nu = 0U;
+	dl_rbm_t um = NULL;
+	int s = -1;
+	int res = 0;
 
-#define w(i, j)		w[i * nh + j]
-#define wtr(i, j)	wtr[i * nv + j]
-#define dw(i, j)	dw[i * nh + j]
+	if (UNLIKELY(of == OFMT_UNK)) {
+		fprintf(stderr, "unknown output format `%s'\n",
+			argi->output_format_arg);
+		return 1;
+	}
+	if (UNLIKELY((argi->top_k_given || argi->min_prob_given) &&
+		     (of != OFMT_TEXT ||
+		      argi->sample_given || argi->samples_given))) {
+		fputs("\
+--top-k and --min-prob need text output of expectations\n", stderr);
+		return 1;
+	}
+	if (UNLIKELY(argi->cache_given && argi->cache_arg > 0 &&
+		     argi->batch_given && argi->batch_arg > 1)) {
+		fputs("\
+--cache propagates one document at a time, drop --batch\n", stderr);
+		return 1;
+	}
 
-	/* bang <v_i h_j> into weights */
-	for (size_t i = 0; i < nv; i++) {
-		for (size_t j = 0; j < nh; j++) {
-			float vho = vo[i] * ho[j];
-			float vhr = vr[i] * hr[j];
-			float d = vho - vhr;
+	if (argi->inputs_num < 2) {
+		fputs("no machine file given\n", stderr);
+		res = 1;
 
-			/* decay */
-			d -= dec * w(i, j);
-			/* learning rate */
-			d *= eta;
-			/* momentum term */
-			d += mom * dw(i, j);
+	} else if (UNLIKELY((m = pump_fl(file, O_RDONLY, mfl)) == NULL)) {
+		/* reading the machine file failed */
+		fprintf(stderr, "error opening machine file `%s'\n", file);
+		res = 1;
 
-#if !defined NDEBUG
-			if (d < mind) {
-				mind = d;
-			}
-			if (d > maxd) {
-				maxd = d;
-			}
-#endif	/* !NDEBUG */
-#if !defined DEFER_UPDATES
-			wtr(j, i) += d;
-			w(i, j) +=
-#endif	/* !DEFER_UPDATES */
-				dw(i, j) = d;
+	} else if (argi->units_given &&
+		   UNLIKELY((u = rd_units(argi->units_arg,
+					  m->nhid, &nu)) == NULL)) {
+		fprintf(stderr, "invalid unit list `%s'\n", argi->units_arg);
+		res = 1;
+
+	} else if (u != NULL && UNLIKELY((um = sub_rbm(m, u, nu)) == NULL)) {
+		fputs("cannot gather hidden units\n", stderr);
+		res = 1;
+
+	} else if (um == NULL && !q8_p(m) && UNLIKELY(wtr_of(m) == NULL)) {
+		/* int8 weights are transposed already, as are units */
+		fprintf(stderr, "cannot transpose weights of `%s'\n", file);
+		res = 1;
+
+	} else if (UNLIKELY((s = serve_sock(file)) < 0)) {
+		fprintf(stderr, "cannot listen on `%s" SERVE_SFX "': %s\n",
+			file, strerror(errno));
+		res = 1;
+
+	} else {
+		/* all clear */
+		static struct drbctx_s ctx[1];
+		const size_t ns = argi->samples_given && argi->samples_arg > 0
+			? (size_t)argi->samples_arg
+			: argi->sample_given || of == OFMT_BITS;
+		/* batch what comes in together unless told otherwise */
+		const size_t nb = !argi->batch_given ? SERVE_NB
+			: argi->batch_arg > 0 ? (size_t)argi->batch_arg : 1U;
+
+		signal(SIGINT, serve_sig);
+		signal(SIGTERM, serve_sig);
+		signal(SIGUSR1, serve_usr);
+
+		init_rand();
+		if (UNLIKELY(init_drbctx(ctx, um ?: m, false) < 0)) {
+			fputs("cannot allocate scratch vectors\n", stderr);
+			res = 1;
+			goto serve_out;
+		}
+		ctx->unit = u;
+		ctx->topk = argi->top_k_given && argi->top_k_arg > 0
+			? (size_t)argi->top_k_arg : 0U;
+		ctx->minp = argi->min_prob_given ? argi->min_prob_arg : 0.f;
+		if (argi->cache_given && argi->cache_arg > 0 &&
+		    UNLIKELY((ctx->pc = make_pcch(
+				      (size_t)argi->cache_arg,
+				      ctx->m->nhid)) == NULL)) {
+			fputs("cannot allocate cache, going without\n", stderr);
+		}
+
+		if (serve(ctx, s, ns, of, nb) < 0) {
+			perror("cannot serve");
+			res = 1;
+		}
+		if (ctx->pc != NULL && argi->verbose_given) {
+			pcch_prnt(ctx->pc, stderr);
+		}
+
+	serve_out:
+		fini_drbctx(ctx);
+		deinit_rand();
+		close(s);
+		with (char sfn[PATH_MAX]) {
+			snprintf(sfn, sizeof(sfn), "%s" SERVE_SFX, file);
+			(void)unlink(sfn);
 		}
 	}
-#if !defined NDEBUG
-	printf("dw (%.6g  %.6g)\n", mind, maxd);
-#endif	/* !NDEBUG */
-#undef w
-#undef wtr
-#undef dw
+
+	dump(um);
+	free(u);
+	dump(m);
+	return res;
+}
+
+/* semantic hashing, a document's code is its hidden expectations
+ * thresholded at 1/2, packed lsb first into 64-bit words, a codes file
+ * is a header followed by the codes of a corpus in corpus order */
+#define HSH_MAGIC	"DrBh"
+/* number of words in a code of N bits */
+#define HSH_NW(n)	(((n) + 63U) / 64U)
+/* search keys hold the distance above, the code's row in these bits */
+#define HSH_IDB		40U
+
+struct hsh_file_s {
+	uint8_t magic[4U];
+	uint8_t pad[4U];
+
+	/* bits per code, nhid of the machine that made them */
+	uint64_t nbit;
+	uint64_t ncode;
+	/* followed by ncode times HSH_NW(nbit) words in host order */
+};
+
+static void
+hsh_enc(uint64_t *restrict c, const float *h, size_t nh)
+{
+/* turn hidden expectations H into code C */
+	memset(c, 0, HSH_NW(nh) * sizeof(*c));
+	for (size_t j = 0U; j < nh; j++) {
+		c[j / 64U] |= (uint64_t)(h[j] > .5f) << (j % 64U);
+	}
 	return;
 }
 
-static ni void
-update_b(drbctx_t ctx)
+static inline unsigned int
+hamm(const uint64_t *a, const uint64_t *b, size_t nw)
 {
-	dl_rbm_t m = ctx->m;
-	const float *vo = ctx->vo;
-	const float *ho = ctx->ho;
-	const float *vr = ctx->vr;
-	const float *hr = ctx->hr;
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
+/* return the Hamming distance between codes A and B of NW words */
+	unsigned int d = 0U;
+	size_t i = 0U;
 
-	/* the real update routine is here, called twice, for vb and hb */
-	auto void __upd(
-		float *restrict b, float *restrict db,
-		const float *o, const float *r, const size_t z)
-	{
-#if !defined NDEBUG
-		float mind = INFINITY;
-		float maxd = -INFINITY;
-#endif	/* !NDEBUG */
+#if defined __AVX512VPOPCNTDQ__
+	with (__m512i acc = _mm512_setzero_si512()) {
+		for (; i + 8U <= nw; i += 8U) {
+			const __m512i x = _mm512_xor_si512(
+				_mm512_loadu_si512(a + i),
+				_mm512_loadu_si512(b + i));
+			acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+		}
+		d = (unsigned int)_mm512_reduce_add_epi64(acc);
+	}
+#endif	/* __AVX512VPOPCNTDQ__ */
+	for (; i < nw; i++) {
+		d += (unsigned int)__builtin_popcountll(a[i] ^ b[i]);
+	}
+	return d;
+}
 
-		for (size_t i = 0; i < z; i++) {
-			float d = o[i] - r[i];
+static int
+cmp_u64(const void *x, const void *y)
+{
+	const uint64_t a = *(const uint64_t*)x;
+	const uint64_t b = *(const uint64_t*)y;
 
-			/* decay */
-			d -= dec * b[i];
-			/* learning rate */
-			d *= eta;
-			/* momentum */
-			d += mom * db[i];
+	return (a > b) - (a < b);
+}
 
-#if !defined NDEBUG
-			if (d < mind) {
-				mind = d;
+struct hsh_scan_s {
+	/* codes to scan, rows LO to HI */
+	const uint64_t *c;
+	size_t lo;
+	size_t hi;
+	size_t nw;
+	/* queries */
+	const uint64_t *q;
+	size_t nq;
+	/* per query a max-heap of the K smallest keys so far */
+	uint64_t *key;
+	size_t k;
+};
+
+static void*
+hsh_scan(void *clo)
+{
+/* find the K codes nearest to each query among the rows of CLO,
+ * every code is read once for all queries */
+	const struct hsh_scan_s *s = clo;
+	const size_t k = s->k;
+
+	for (size_t i = s->lo; i < s->hi; i++) {
+		const uint64_t *ci = s->c + i * s->nw;
+
+		for (size_t j = 0U; j < s->nq; j++) {
+			uint64_t *restrict hp = s->key + j * k;
+			const uint64_t x = (uint64_t)hamm(
+				ci, s->q + j * s->nw, s->nw) << HSH_IDB | i;
+			size_t p = 0U;
+
+			if (LIKELY(x >= *hp)) {
+				/* not better than the k-th best */
+				continue;
 			}
-			if (d > maxd) {
-				maxd = d;
+			/* replace the root and sift it down */
+			for (size_t c; (c = 2U * p + 1U) < k; p = c) {
+				c += c + 1U < k && hp[c + 1U] > hp[c];
+				if (hp[c] <= x) {
+					break;
+				}
+				hp[p] = hp[c];
 			}
-#endif	/* !NDEBUG */
-#if !defined DEFER_UPDATES
-			b[i] +=
-#endif	/* !DEFER_UPDATES */
-				db[i] = d;
+			hp[p] = x;
 		}
-#if !defined NDEBUG
-		printf("db (%.6g  %.6g)\n", mind, maxd);
-#endif	/* !NDEBUG */
 	}
-
-	/* bias update */
-	__upd(m->vbias, ctx->dv, vo, vr, nv);
-	__upd(m->hbias, ctx->dh, ho, hr, nh);
-	return;
+	return NULL;
 }
 
-static ni void
-final_update_w(drbctx_t ctx)
+/* multi-index hashing, CODES_FILE.mih cuts every code into NSUB
+ * substrings and keeps a hash table per substring from its value to the
+ * rows carrying it, a code within R bits of a query is within R / NSUB
+ * bits of it on at least one substring, so probing every table for all
+ * values that close turns up every code within R */
+#define MIH_MAGIC	"DrBm"
+#define MIH_SFX		".mih"
+/* substrings are at most this wide */
+#define MIH_MAXB	32U
+
+struct mih_file_s {
+	uint8_t magic[4U];
+	uint8_t pad[4U];
+
+	uint64_t nbit;
+	/* rows indexed, i.e. the first NCODE rows of the codes file */
+	uint64_t ncode;
+	uint64_t nsub;
+	/* slots per table, a power of 2 */
+	uint64_t nslot;
+	/* followed by NSUB tables of NSLOT slots,
+	 * then NCODE times NSUB links, all in host order */
+};
+
+struct mih_slot_s {
+	/* substring value */
+	uint64_t key;
+	/* 1 + the last row with that value, 0 for empty slots */
+	uint64_t head;
+};
+
+struct mih_s {
+	size_t nbit;
+	size_t ncode;
+	size_t nsub;
+	size_t nslot;
+	struct mih_slot_s *slot;
+	/* per row and substring 1 + the previous row with the same value,
+	 * 0 at the end of the chain */
+	uint32_t *link;
+	/* only when building, used slots per table and room for links */
+	size_t *nused;
+	size_t zl;
+};
+
+static inline size_t
+mih_lo(const struct mih_s *ix, size_t t)
 {
-/* finalise the weight update */
-#if defined DEFER_UPDATES
-	const size_t nv = ctx->m->nvis;
-	const size_t nh = ctx->m->nhid;
+/* return the first bit of substring T */
+	return ix->nbit * t / ix->nsub;
+}
 
-#define w(i, j)		ctx->m->w[i * nh + j]
-#define dw(i, j)	ctx->dw[i * nh + j]
+static inline uint64_t
+mih_sub(const uint64_t *c, size_t lo, size_t n)
+{
+/* return N bits of code C starting at bit LO, N <= MIH_MAXB */
+	uint64_t x = c[lo / 64U] >> (lo % 64U);
 
-	/* now really bang <v_i h_j> into weights */
-	for (size_t i = 0; i < nv; i++) {
-		for (size_t j = 0; j < nh; j++) {
-			w(i, j) += dw(i, j);
-		}
+	if (lo % 64U + n > 64U) {
+		x |= c[lo / 64U + 1U] << (64U - lo % 64U);
 	}
-#undef w
-#undef dw
-#else  /* !DEFER_UPDATES */
-	ctx = ctx;
-#endif	/* DEFER_UPDATES */
-	return;
+	return x & ((1ULL << n) - 1U);
 }
 
-static ni void
-final_update_b(drbctx_t ctx)
+static inline struct mih_slot_s*
+mih_slot(const struct mih_s *ix, size_t t, uint64_t key)
 {
-/* finalise the weight update */
-#if defined DEFER_UPDATES
-	const size_t nv = ctx->m->nvis;
-	const size_t nh = ctx->m->nhid;
-
-#define v(i)		ctx->m->vbias[i]
-#define dv(i)		ctx->dv[i]
+/* return the slot of KEY in table T, or the empty slot it would go to */
+	struct mih_slot_s *tab = ix->slot + t * ix->nslot;
+	const size_t msk = ix->nslot - 1U;
+	size_t i = (size_t)(key * 0x9e3779b97f4a7c15ULL >> 32U) & msk;
 
-	/* now really bang bias updates into the biasses */
-	for (size_t i = 0; i < nv; i++) {
-		v(i) += dv(i);
+	while (tab[i].head && tab[i].key != key) {
+		i = (i + 1U) & msk;
 	}
-#undef v
-#undef dv
+	return tab + i;
+}
 
-#define h(i)		ctx->m->hbias[i]
-#define dh(i)		ctx->dh[i]
-	for (size_t j = 0; j < nh; j++) {
-		h(j) += dh(j);
+static int
+mih_view(struct mih_s *restrict ix, glodf_t fb, const struct hsh_file_s *h)
+{
+/* point IX at the index mapped in FB if it indexes codes like those of
+ * H and no more of them, return -1 otherwise, the header is checked
+ * before its sizes are multiplied out, and the tables before anyone
+ * follows them: heads must name indexed rows, links earlier rows (so
+ * chains end), and every table needs an empty slot (so probes end) */
+	const struct mih_file_s *fh = fb.d;
+	size_t zs;
+	size_t zl;
+
+	if (fb.z < sizeof(*fh) || memcmp(fh->magic, MIH_MAGIC, 4U) ||
+	    fh->nbit != h->nbit || fh->ncode > h->ncode ||
+	    !fh->nsub || fh->nsub > fh->nbit ||
+	    fh->nsub * MIH_MAXB < fh->nbit ||
+	    !fh->nslot || (fh->nslot & (fh->nslot - 1U)) ||
+	    __builtin_mul_overflow(fh->nsub, fh->nslot, &zs) ||
+	    __builtin_mul_overflow(zs, sizeof(*ix->slot), &zs) ||
+	    __builtin_mul_overflow(fh->ncode, fh->nsub, &zl) ||
+	    __builtin_mul_overflow(zl, sizeof(*ix->link), &zl) ||
+	    __builtin_add_overflow(zs, zl, &zs) ||
+	    fb.z - sizeof(*fh) < zs) {
+		return -1;
 	}
-#else  /* !DEFER_UPDATES */
-	ctx = ctx;
-#endif	/* DEFER_UPDATES */
-	return;
+	*ix = (struct mih_s){
+		.nbit = fh->nbit,
+		.ncode = fh->ncode,
+		.nsub = fh->nsub,
+		.nslot = fh->nslot,
+		.slot = (void*)((char*)fb.d + sizeof(*fh)),
+	};
+	ix->link = (void*)(ix->slot + ix->nsub * ix->nslot);
+
+	for (size_t t = 0U; t < ix->nsub; t++) {
+		const struct mih_slot_s *tab = ix->slot + t * ix->nslot;
+		size_t nused = 0U;
+
+		for (size_t i = 0U; i < ix->nslot; i++) {
+			if (tab[i].head > ix->ncode) {
+				return -1;
+			}
+			nused += tab[i].head > 0U;
+		}
+		if (nused >= ix->nslot) {
+			return -1;
+		}
+	}
+	for (size_t i = 0U; i < ix->ncode; i++) {
+		for (size_t t = 0U; t < ix->nsub; t++) {
+			if (ix->link[i * ix->nsub + t] > i) {
+				return -1;
+			}
+		}
+	}
+	return 0;
 }
 
-static void
-train(drbctx_t ctx, struct spsv_s sv)
+static int
+mih_grow(struct mih_s *restrict ix)
 {
-	const dl_rbm_t m = ctx->m;
-	float *restrict vo = ctx->vo;
-	float *restrict ho = ctx->ho;
-	float *restrict vr = ctx->vr;
-	float *restrict hr = ctx->hr;
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
+/* double the slots of all tables */
+	struct mih_s nu = *ix;
 
-	DEBUG(float *hs = calloc(nh, sizeof(*hs)));
-
-	/* populate from input */
-#if defined SALAKHUTDINOV
-	N = popul_sv(vo, nv, sv);
-#else  /* !SALAKHUTDINOV */
-	(void)popul_sv(vo, nv, sv);
-#endif	/* SALAKHUTDINOV */
+	nu.nslot = 2U * ix->nslot;
+	if (UNLIKELY((nu.slot = calloc(
+			      nu.nsub * nu.nslot, sizeof(*nu.slot))) == NULL)) {
+		return -1;
+	}
+	for (size_t t = 0U; t < ix->nsub; t++) {
+		const struct mih_slot_s *tab = ix->slot + t * ix->nslot;
 
-	/* vh gibbs */
-	prop_up(ho, m, vo);
-	expt_hid(ho, m, ho);
-	/* don't sample into ho, use hr instead, we want the activations */
-	smpl_hid(hr, m, ho);
-	DEBUG(size_t nho = count_layer(hr, nh));
+		for (size_t i = 0U; i < ix->nslot; i++) {
+			if (tab[i].head) {
+				*mih_slot(&nu, t, tab[i].key) = tab[i];
+			}
+		}
+	}
+	free(ix->slot);
+	ix->slot = nu.slot;
+	ix->nslot = nu.nslot;
+	return 0;
+}
 
-	/* hv gibbs */
-	prop_down(vr, m, hr);
-	expt_vis(vr, m, vr);
-	smpl_vis(vr, m, vr);
-	/* vh gibbs */
-	prop_up(hr, m, vr);
-	expt_hid(hr, m, hr);
+static int
+mih_add(struct mih_s *restrict ix, const uint64_t *c)
+{
+/* index code C as the next row */
+	const size_t r = ix->ncode;
+
+	if (UNLIKELY(r >= UINT32_MAX)) {
+		/* links are 32 bits wide */
+		errno = EOVERFLOW;
+		return -1;
+	} else if (r >= ix->zl) {
+		const size_t nu = ix->zl ? 2U * ix->zl : 4096U;
+		uint32_t *l = realloc(ix->link, nu * ix->nsub * sizeof(*l));
+
+		if (UNLIKELY(l == NULL)) {
+			return -1;
+		}
+		ix->link = l;
+		ix->zl = nu;
+	}
+	for (size_t t = 0U; t < ix->nsub; t++) {
+		const size_t lo = mih_lo(ix, t);
+		const uint64_t key = mih_sub(c, lo, mih_lo(ix, t + 1U) - lo);
+		struct mih_slot_s *s;
+
+		if (2U * (ix->nused[t] + 1U) > ix->nslot &&
+		    UNLIKELY(mih_grow(ix) < 0)) {
+			return -1;
+		}
+		if (!(s = mih_slot(ix, t, key))->head) {
+			s->key = key;
+			ix->nused[t]++;
+		}
+		ix->link[r * ix->nsub + t] = (uint32_t)s->head;
+		s->head = r + 1U;
+	}
+	ix->ncode++;
+	return 0;
+}
 
-	DEBUG(
-		smpl_hid(hs, m, hr);
-		size_t nhr = count_layer(hs, nh);
-		);
+static int
+mih_sync(const char *cfn, const struct hsh_file_s *h, size_t nsub, bool frshp)
+{
+/* bring the index of codes file CFN, whose codes H are, up to date by
+ * indexing the rows it doesn't cover yet, or all rows if FRSHP or if
+ * there's no usable index, new indices get NSUB substrings, 0 for the
+ * count of the old index or else as few as MIH_MAXB allows */
+	const size_t nw = HSH_NW(h->nbit);
+	const uint64_t *c = (const void*)(h + 1U);
+	char fn[PATH_MAX];
+	char tmp[PATH_MAX];
+	struct mih_s ix = {.nslot = 1024U};
+	glodfn_t f = {.fd = -1};
+	FILE *o;
+	int res = -1;
+
+	if (UNLIKELY((size_t)snprintf(
+			     fn, sizeof(fn), "%s" MIH_SFX, cfn) >= sizeof(fn) ||
+		     (size_t)snprintf(
+			     tmp, sizeof(tmp), "%s.t", fn) >= sizeof(tmp))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((f = mmap_fn(fn, O_RDONLY, MAP_SHARED)).fb.d != NULL &&
+	    mih_view(&ix, f.fb, h) == 0) {
+		nsub = nsub ?: ix.nsub;
+		if (!frshp && nsub == ix.nsub) {
+			/* pick up where it left off */
+			const struct mih_slot_s *sl = ix.slot;
+			const uint32_t *ln = ix.link;
+
+			ix.zl = ix.ncode;
+			ix.slot = malloc(ix.nsub * ix.nslot * sizeof(*sl));
+			ix.link = malloc(ix.zl * ix.nsub * sizeof(*ln));
+			ix.nused = calloc(ix.nsub, sizeof(*ix.nused));
+			if (UNLIKELY(ix.slot == NULL ||
+				     (ix.zl && ix.link == NULL) ||
+				     ix.nused == NULL)) {
+				goto out;
+			}
+			memcpy(ix.slot, sl, ix.nsub * ix.nslot * sizeof(*sl));
+			memcpy(ix.link, ln, ix.zl * ix.nsub * sizeof(*ln));
+			for (size_t i = 0U; i < ix.nsub * ix.nslot; i++) {
+				ix.nused[i / ix.nslot] += !!sl[i].head;
+			}
+			goto add;
+		}
+	}
+	/* start afresh */
+	nsub = nsub ?: (h->nbit + MIH_MAXB - 1U) / MIH_MAXB;
+	if (UNLIKELY(nsub * MIH_MAXB < h->nbit || nsub > h->nbit)) {
+		errno = EINVAL;
+		goto out;
+	}
+	ix = (struct mih_s){
+		.nbit = h->nbit,
+		.nsub = nsub,
+		.nslot = 1024U,
+		.slot = calloc(nsub * 1024U, sizeof(*ix.slot)),
+		.nused = calloc(nsub, sizeof(*ix.nused)),
+	};
+	if (UNLIKELY(ix.slot == NULL || ix.nused == NULL)) {
+		goto out;
+	}
+add:
+	for (size_t r = ix.ncode; r < h->ncode; r++) {
+		if (UNLIKELY(mih_add(&ix, c + r * nw) < 0)) {
+			goto out;
+		}
+	}
 
-#if !defined NDEBUG
-	size_t nso = count_layer(vo, nv);
-	size_t nsr = count_layer(vr, nv);
-	float Nso = integ_layer(vo, nv);
-	float Nsr = integ_layer(vr, nv);
-	printf("|vo| %zu  |vr| %zu  Nvo %.6g  Nvr %.6g\n", nso, nsr, Nso, Nsr);
-	printf("|ho| %zu  |hr| %zu\n", nho, nhr);
-#endif	/* !NDEBUG */
+	/* write a new index and move it over the old one */
+	if (UNLIKELY((o = fopen(tmp, "w")) == NULL)) {
+		goto out;
+	}
+	with (struct mih_file_s fh = {
+		      .magic = MIH_MAGIC,
+		      .nbit = ix.nbit,
+		      .ncode = ix.ncode,
+		      .nsub = ix.nsub,
+		      .nslot = ix.nslot,
+	      }) {
+		const size_t ns = ix.nsub * ix.nslot;
+		const size_t nl = ix.ncode * ix.nsub;
+
+		setvbuf(o, NULL, _IOFBF, OFMT_BUFZ);
+		if (fwrite(&fh, sizeof(fh), 1U, o) < 1U ||
+		    fwrite(ix.slot, sizeof(*ix.slot), ns, o) < ns ||
+		    fwrite(ix.link, sizeof(*ix.link), nl, o) < nl) {
+			(void)fclose(o);
+			(void)unlink(tmp);
+			goto out;
+		}
+	}
+	if (UNLIKELY(fclose(o) < 0 || rename(tmp, fn) < 0)) {
+		(void)unlink(tmp);
+		goto out;
+	}
+	res = 0;
+out:
+	(void)munmap_fn(f);
+	if (ix.nused != NULL) {
+		/* IX is ours rather than a view of F */
+		free(ix.slot);
+		free(ix.link);
+		free(ix.nused);
+	}
+	return res;
+}
 
-	/* we won't sample the h reconstruction as we want to use the
-	 * the activations directly */
-	update_w(ctx);
-	update_b(ctx);
+static size_t
+mih_nprb(const struct mih_s *ix, size_t r)
+{
+/* return the number of probes mih_near() makes for radius R,
+ * saturating at SIZE_MAX */
+	const size_t rs = r / ix->nsub;
+	size_t res = 0U;
 
-#if !defined NDEBUG
-	dump_layer("h", m->hbias, nh);
-	dump_layer("v", m->vbias, nv);
-	dump_layer("w", m->w, nh * nv);
-#endif	/* !NDEBUG */
+	for (size_t t = 0U; t < ix->nsub; t++) {
+		const size_t len = mih_lo(ix, t + 1U) - mih_lo(ix, t);
 
-	DEBUG(free(hs));
-	return;
+		/* C(LEN, D) for D = 0, 1, ..., exact in integers */
+		for (size_t d = 0U, b = 1U; d <= rs && d <= len;
+		     b = b * (len - d) / (d + 1U), d++) {
+			if (__builtin_add_overflow(res, b, &res)) {
+				return SIZE_MAX;
+			}
+		}
+	}
+	return res;
 }
 
-static void
-prop(drbctx_t ctx, spsv_t sv, int smplp)
+static ssize_t
+mih_near(
+	const struct mih_s *ix, const uint64_t *c, size_t nc,
+	const uint64_t *q, size_t r, uint64_t **kp, size_t *zp)
 {
-#define m	ctx->m
-#define vo	ctx->vo
-#define ho	ctx->ho
-	const size_t nv = m->nvis;
-	const size_t nh = m->nhid;
+/* put the search keys of the codes C within R bits of query Q into *KP,
+ * of size *ZP and grown as need be, sorted and without duplicates,
+ * rows beyond those IX indexes are scanned, return the number of keys */
+	const size_t nw = HSH_NW(ix->nbit);
+	const size_t rs = r / ix->nsub;
+	size_t n = 0U;
+
+	/* check row I and note its key if it's close enough */
+	auto inline int chk(size_t i)
+	{
+		const size_t d = hamm(c + i * nw, q, nw);
 
-	/* populate from input */
-#if defined SALAKHUTDINOV
-	N = popul_sv(vo, nv, sv);
-#else  /* !SALAKHUTDINOV */
-	(void)popul_sv(vo, nv, sv);
-#endif	/* SALAKHUTDINOV */
+		if (d > r) {
+			return 0;
+		} else if (UNLIKELY(n >= *zp)) {
+			const size_t nu = *zp ? 2U * *zp : 256U;
+			uint64_t *k = realloc(*kp, nu * sizeof(*k));
 
-	/* vh gibbs */
-	prop_up(ho, m, vo);
-	expt_hid(ho, m, ho);
-	if (!smplp) {
-		for (size_t i = 0; i < nh; i++) {
-			printf("%g\n", ho[i]);
+			if (UNLIKELY(k == NULL)) {
+				return -1;
+			}
+			*kp = k;
+			*zp = nu;
 		}
-	} else {
-		/* oh, madame wants sampling as well */
-		size_t nsmpl = 0U;
-
-		smpl_hid(ho, m, ho);
+		(*kp)[n++] = (uint64_t)d << HSH_IDB | i;
+		return 0;
+	}
 
-		for (size_t i = 0U; i < nh; i++) {
-			uint8_t hi = (uint8_t)(int)ho[i];
+	for (size_t t = 0U; t < ix->nsub; t++) {
+		const size_t lo = mih_lo(ix, t);
+		const size_t len = mih_lo(ix, t + 1U) - lo;
+		const uint64_t qs = mih_sub(q, lo, len);
+
+		for (size_t d = 0U; d <= rs && d <= len; d++) {
+			/* all LEN-bit masks with D bits set, in Gosper order */
+			for (uint64_t x = (1ULL << d) - 1U; x < 1ULL << len;) {
+				const struct mih_slot_s *s =
+					mih_slot(ix, t, qs ^ x);
+
+				for (size_t h = s->head; h;
+				     h = ix->link[(h - 1U) * ix->nsub + t]) {
+					if (UNLIKELY(chk(h - 1U) < 0)) {
+						return -1;
+					}
+				}
+				if (!x) {
+					break;
+				}
+				with (const uint64_t lsb = x & -x) {
+					const uint64_t y = x + lsb;
 
-			if (UNLIKELY(hi)) {
-				printf("%zu\t%u\n", i, (unsigned int)hi);
-				nsmpl++;
+					x = (((y ^ x) >> 2U) / lsb) | y;
+				}
 			}
 		}
-		if (LIKELY(nsmpl)) {
-			puts("\f");
+	}
+	for (size_t i = ix->ncode; i < nc; i++) {
+		/* not indexed yet */
+		if (UNLIKELY(chk(i) < 0)) {
+			return -1;
+		}
+	}
+	/* codes close on several substrings turn up several times */
+	qsort(*kp, n, sizeof(**kp), cmp_u64);
+	with (size_t u = 0U) {
+		for (size_t i = 0U; i < n; i++) {
+			if (!u || (*kp)[i] != (*kp)[u - 1U]) {
+				(*kp)[u++] = (*kp)[i];
+			}
 		}
+		n = u;
+	}
+	return (ssize_t)n;
+}
+
+struct hsh_qry_s {
+	/* the codes file's codes */
+	const uint64_t *c;
+	size_t nc;
+	size_t nw;
+	/* queries so far and room for NB of them */
+	uint64_t *q;
+	size_t nq;
+	size_t nb;
+	/* answer size and scanning threads */
+	size_t k;
+	size_t nth;
+	/* NTH * NB * K keys for hsh_scan(), NTH * K to merge them */
+	uint64_t *key;
+	uint64_t *mk;
+	size_t zmk;
+	/* only codes within this radius, and the index to find them with
+	 * if non-NULL, see mih_near() */
+	size_t rad;
+	const struct mih_s *ix;
+	FILE *out;
+};
+
+static void
+hsh_prt(FILE *out, const uint64_t *key, size_t n, size_t k, size_t rad)
+{
+/* print up to K of the N sorted search keys KEY within RAD as ID<TAB>DIST,
+ * followed by a form feed line, all-ones keys are unused heap slots */
+	for (size_t i = 0U; i < n && i < k && key[i] != UINT64_MAX &&
+		     key[i] >> HSH_IDB <= rad; i++) {
+		fprintf(out, "%zu\t%zu\n",
+			(size_t)(key[i] & ((1ULL << HSH_IDB) - 1U)),
+			(size_t)(key[i] >> HSH_IDB));
 	}
+	fputs("\f\n", out);
 	return;
-#undef m
-#undef vo
-#undef ho
 }
 
 static int
-check(dl_rbm_t m)
+hsh_flush(struct hsh_qry_s *restrict h)
 {
-	int res = 0;
-
-	with (size_t nv = m->nvis, nh = m->nhid) {
-		for (size_t i = 0; i < nv; i++) {
-			if (UNLIKELY(isnan(m->vbias[i]))) {
-				printf("VBIAS[%zu] <- NAN\n", i);
-				res = 1;
-			}
+/* answer the queries in H, each with the K nearest codes as ID<TAB>DIST,
+ * nearest first, followed by a form feed line, NTH threads scan a slice
+ * of the codes each */
+	const size_t k = h->k;
+	const size_t nth = h->nth < h->nc ? h->nth : h->nc + !h->nc;
+	struct hsh_scan_s sc[nth];
+	pthread_t th[nth];
+	bool thp[nth];
+
+	memset(h->key, 0xff, nth * h->nq * k * sizeof(*h->key));
+	for (size_t t = 0U; t < nth; t++) {
+		sc[t] = (struct hsh_scan_s){
+			h->c, h->nc * t / nth, h->nc * (t + 1U) / nth, h->nw,
+			h->q, h->nq, h->key + t * h->nq * k, k,
+		};
+	}
+	for (size_t t = 1U; t < nth; t++) {
+		thp[t] = !pthread_create(th + t, NULL, hsh_scan, sc + t);
+	}
+	/* we scan the first slice ourselves, and those without a thread */
+	(void)hsh_scan(sc);
+	for (size_t t = 1U; t < nth; t++) {
+		if (thp[t]) {
+			(void)pthread_join(th[t], NULL);
+		} else {
+			(void)hsh_scan(sc + t);
 		}
-		for (size_t j = 0; j < nh; j++) {
-			if (UNLIKELY(isnan(m->hbias[j]))) {
-				printf("HBIAS[%zu] <- NAN\n", j);
-				res = 1;
-			}
+	}
+
+	for (size_t j = 0U; j < h->nq; j++) {
+		for (size_t t = 0U; t < nth; t++) {
+			memcpy(h->mk + t * k, sc[t].key + j * k,
+			       k * sizeof(*h->mk));
 		}
-		for (size_t i = 0; i < nv; i++) {
-			for (size_t j = 0; j < nh; j++) {
-				if (UNLIKELY(isnan(m->w[i * nh + j]))) {
-					printf("W[%zu,%zu] <- NAN\n", i, j);
-					res = 1;
-				}
-			}
+		qsort(h->mk, nth * k, sizeof(*h->mk), cmp_u64);
+		/* unused heap entries are all ones and sort last */
+		hsh_prt(h->out, h->mk, nth * k, k, h->rad);
+	}
+	h->nq = 0U;
+	return 0;
+}
+
+static int
+hsh_qrow(drbctx_t ctx, float *h, void *clo)
+{
+/* queue hidden expectations H as query, answer once there's a batch,
+ * or straight away if there's an index */
+	struct hsh_qry_s *q = clo;
+
+	hsh_enc(q->q + q->nq++ * q->nw, h, ctx->m->nhid);
+	if (q->ix != NULL) {
+		/* merge buffer doubles as candidate list */
+		const ssize_t n = mih_near(
+			q->ix, q->c, q->nc, q->q, q->rad, &q->mk, &q->zmk);
+
+		if (UNLIKELY(n < 0)) {
+			return -1;
 		}
+		hsh_prt(q->out, q->mk, (size_t)n, q->k, q->rad);
+		q->nq = 0U;
+		return 0;
+	} else if (q->nq < q->nb) {
+		return 0;
 	}
-	return res;
+	return hsh_flush(q);
 }
 
-
-#if defined __INTEL_COMPILER
-# pragma warning (disable:593)
-# pragma warning (disable:181)
-#endif	/* __INTEL_COMPILER */
-#include "rbm.xh"
-#include "rbm.x"
-#if defined __INTEL_COMPILER
-# pragma warning (default:593)
-# pragma warning (default:181)
-#endif	/* __INTEL_COMPILER */
+struct hsh_out_s {
+	FILE *f;
+	uint64_t *c;
+	size_t n;
+};
 
 static int
-cmd_init(struct glod_args_info argi[static 1])
+hsh_row(drbctx_t ctx, float *h, void *clo)
 {
-/* shell return codes, 0 success, 1 failure */
-	const char *file = argi->inputs[1U];
-	struct dl_spec_s dim;
-	dl_rbm_t m;
-	int res = 0;
+/* append the code of hidden expectations H to the codes file */
+	struct hsh_out_s *o = clo;
+	const size_t nw = HSH_NW(ctx->m->nhid);
 
-	/* parse dimens */
-	with (char *chk = argi->dimen_arg) {
-		dim.nvis = strtoul(chk, &chk, 0);
-		if ((*chk++ | 0x20) != 'x') {
-			res = 1;
-			goto out;
-		}
-		dim.nhid = strtoul(chk, &chk, 0);
-		if (*chk) {
-			res = 1;
-			goto out;
-		}
+	hsh_enc(o->c, h, ctx->m->nhid);
+	if (UNLIKELY(fwrite(o->c, sizeof(*o->c), nw, o->f) < nw)) {
+		return -1;
 	}
+	o->n++;
+	return 0;
+}
 
-	/* just create (or resize) the machine */
-	if (argi->inputs_num < 2) {
-		fputs("no machine file given\n", stderr);
-		res = 1;
-	} else if (!argi->resize_given && (m = crea(file, dim)) == NULL) {
-		fprintf(stderr, "error creating machine file `%s'\n", file);
-		res = 1;
-	} else if (argi->resize_given && (m = pump(file, O_RDWR)) == NULL) {
-		fprintf(stderr, "error loading machine file `%s'\n", file);
-		res = 1;
-	} else if (argi->resize_given && resz(m, dim) < 0) {
-		/* actually do resize now (in --resize mode) */
-		res = 1;
-	} else {
-		/* for both cases, write the file to disk */
-		res = dump(m);
+static FILE*
+hsh_open(const char *cfn, size_t nbit, bool appp, struct hsh_file_s *restrict h)
+{
+/* open codes file CFN for NBIT-bit codes to go to its end, if APPP and
+ * it exists, or to start a new one, its header goes to H */
+	FILE *f;
+
+	if (appp && (f = fopen(cfn, "r+")) != NULL) {
+		if (fread(h, sizeof(*h), 1U, f) < 1U ||
+		    memcmp(h->magic, HSH_MAGIC, 4U) || h->nbit != nbit ||
+		    fseeko(f, (off_t)(sizeof(*h) + h->ncode *
+				      HSH_NW(nbit) * sizeof(uint64_t)),
+			   SEEK_SET) < 0) {
+			(void)fclose(f);
+			errno = EINVAL;
+			return NULL;
+		}
+		return f;
+	} else if ((f = fopen(cfn, "w")) == NULL) {
+		return NULL;
 	}
-out:
-	return res;
+	*h = (struct hsh_file_s){.magic = HSH_MAGIC, .nbit = nbit};
+	/* header goes first, and again once we know the count */
+	if (UNLIKELY(fwrite(h, sizeof(*h), 1U, f) < 1U)) {
+		(void)fclose(f);
+		return NULL;
+	}
+	return f;
 }
 
 static int
-cmd_train(struct glod_args_info argi[static 1])
+cmd_hash(struct glod_args_info argi[static 1])
 {
-	static jmp_buf jb;
 	const char *file = argi->inputs[1U];
+	const char *cfn = argi->inputs[2U];
+	const int mfl = argi->in_core_given ? MAP_ANONYMOUS : MAP_SHARED;
+	struct hsh_file_s hdr;
 	dl_rbm_t m = NULL;
+	FILE *f = NULL;
+	size_t n0 = 0U;
 	int res = 0;
 
-	if (argi->inputs_num < 2) {
-		fputs("no machine file given\n", stderr);
+	if (argi->inputs_num < 3) {
+		fputs("need a machine file and a codes file\n", stderr);
 		res = 1;
 
-	} else if (UNLIKELY((m = pump(file, O_RDWR)) == NULL)) {
+	} else if (UNLIKELY((m = pump_fl(file, O_RDONLY, mfl)) == NULL)) {
 		/* reading the machine file failed */
 		fprintf(stderr, "error opening machine file `%s'\n", file);
 		res = 1;
 
-	} else if (setjmp(jb)) {
-		/* C-c handler */
-		goto train_xit;
+	} else if (!q8_p(m) && UNLIKELY(wtr_of(m) == NULL)) {
+		/* int8 weights are transposed already */
+		fprintf(stderr, "cannot transpose weights of `%s'\n", file);
+		res = 1;
+
+	} else if (UNLIKELY((f = hsh_open(
+				     cfn, m->nhid, argi->append_given,
+				     &hdr)) == NULL)) {
+		fprintf(stderr, "cannot open codes file `%s': %s\n",
+			cfn, strerror(errno));
+		res = 1;
 
 	} else {
 		/* all clear */
 		static struct drbctx_s ctx[1];
-		const int fd = STDIN_FILENO;
-		const size_t batchz = argi->batch_size_arg;
-		size_t i = 0;
-
-		/* set up C-c handling (dirtee) */
-		auto __attribute__((noreturn)) void si_train(int UNUSED(sig))
-		{
-			longjmp(jb, 1U);
-		}
-		signal(SIGINT, si_train);
+		const size_t nb = argi->batch_arg > 0
+			? (size_t)argi->batch_arg : 1U;
+		struct hsh_out_s o = {
+			f, calloc(HSH_NW(m->nhid), sizeof(*o.c)), 0U,
+		};
 
 		init_rand();
-		init_drbctx(ctx, m);
-
-		for (spsv_t sv; (sv = read_tf(fd)).z; train(ctx, sv)) {
-			if (++i == batchz) {
-				/* update weights and biasses */
-				final_update_w(ctx);
-				final_update_b(ctx);
-				rset_drbctx(ctx);
-				i = 0U;
-			}
+		if (UNLIKELY(o.c == NULL || init_drbctx(ctx, m, false) < 0)) {
+			perror("cannot hash");
+			res = 1;
+			goto hash_out;
 		}
-	train_xit:
-		/* also hopped to by the signal handler */
-		final_update_w(ctx);
-		final_update_b(ctx);
+		setvbuf(f, NULL, _IOFBF, OFMT_BUFZ);
 
-		/* just to deinitialise resources */
-		(void)read_tf(-1);
+		n0 = hdr.ncode;
+		if (UNLIKELY(each_hid(ctx, nb, hsh_row, &o) < 0)) {
+			goto wrerr;
+		}
+		hdr.ncode += o.n;
+		if (UNLIKELY(fseeko(f, 0, SEEK_SET) < 0 ||
+			     fwrite(&hdr, sizeof(hdr), 1U, f) < 1U)) {
+			goto wrerr;
+		}
+		if (0) {
+		wrerr:
+			fprintf(stderr, "cannot write codes file `%s': %s\n",
+				cfn, strerror(errno));
+			res = 1;
+		}
+	hash_out:
+		free(o.c);
 		fini_drbctx(ctx);
-		dump(m);
 		deinit_rand();
 	}
+
+	if (f != NULL && UNLIKELY(fclose(f) < 0) && !res) {
+		fprintf(stderr, "cannot write codes file `%s': %s\n",
+			cfn, strerror(errno));
+		res = 1;
+	}
+	if (f != NULL && !res) {
+		/* keep the index, if any, in line with the codes */
+		char fn[PATH_MAX];
+		glodfn_t cf = {.fd = -1};
+
+		snprintf(fn, sizeof(fn), "%s" MIH_SFX, cfn);
+		if (!argi->index_given && access(fn, F_OK) < 0) {
+			;
+		} else if (UNLIKELY((cf = mmap_fn(
+					     cfn, O_RDONLY,
+					     MAP_SHARED)).fb.d == NULL ||
+				    mih_sync(cfn, cf.fb.d,
+					     argi->index_given &&
+					     argi->index_arg > 0
+					     ? (size_t)argi->index_arg : 0U,
+					     !n0) < 0)) {
+			fprintf(stderr, "cannot index codes file `%s': %s\n",
+				cfn, strerror(errno));
+			res = 1;
+		}
+		(void)munmap_fn(cf);
+	}
+	(void)read_tf(-1);
+	dump(m);
 	return res;
 }
 
 static int
-cmd_prop(struct glod_args_info argi[static 1])
+cmd_query(struct glod_args_info argi[static 1])
 {
-	static jmp_buf jb;
 	const char *file = argi->inputs[1U];
+	const char *cfn = argi->inputs[2U];
+	const int mfl = argi->in_core_given ? MAP_ANONYMOUS : MAP_SHARED;
+	const struct hsh_file_s *hdr = NULL;
+	glodfn_t cf = {.fd = -1};
 	dl_rbm_t m = NULL;
 	int res = 0;
 
-	if (argi->inputs_num < 2) {
-		fputs("no machine file given\n", stderr);
+	if (argi->inputs_num < 3) {
+		fputs("need a machine file and a codes file\n", stderr);
 		res = 1;
 
-	} else if (UNLIKELY((m = pump(file, O_RDONLY)) == NULL)) {
+	} else if (UNLIKELY((m = pump_fl(file, O_RDONLY, mfl)) == NULL)) {
 		/* reading the machine file failed */
 		fprintf(stderr, "error opening machine file `%s'\n", file);
 		res = 1;
 
-	} else if (setjmp(jb)) {
-		/* C-c handler */
-		goto prop_xit;
+	} else if (!q8_p(m) && UNLIKELY(wtr_of(m) == NULL)) {
+		/* int8 weights are transposed already */
+		fprintf(stderr, "cannot transpose weights of `%s'\n", file);
+		res = 1;
+
+	} else if (UNLIKELY((cf = mmap_fn(cfn, O_RDONLY, mfl)).fb.d == NULL)) {
+		fprintf(stderr, "cannot open codes file `%s': %s\n",
+			cfn, strerror(errno));
+		res = 1;
+
+	} else if (UNLIKELY(cf.fb.z < sizeof(*hdr) ||
+			    memcmp((hdr = cf.fb.d)->magic, HSH_MAGIC, 4U) ||
+			    cf.fb.z < sizeof(*hdr) + hdr->ncode *
+			    HSH_NW(hdr->nbit) * sizeof(uint64_t))) {
+		fprintf(stderr, "`%s' is not a codes file\n", cfn);
+		res = 1;
+
+	} else if (UNLIKELY(hdr->nbit != m->nhid)) {
+		fprintf(stderr, "\
+codes in `%s' have %zu bits, machine has %zu hidden units\n",
+			cfn, (size_t)hdr->nbit, m->nhid);
+		res = 1;
 
 	} else {
 		/* all clear */
 		static struct drbctx_s ctx[1];
-		const int fd = STDIN_FILENO;
-		const int smplp = argi->sample_given;
-
-		/* set up the C-c handler */
-		auto __attribute__((noreturn)) void si_prop(int UNUSED(sig))
-		{
-			longjmp(jb, 2U);
+		const size_t nw = HSH_NW(m->nhid);
+		const size_t nb = argi->batch_arg > 0
+			? (size_t)argi->batch_arg : 1U;
+		const size_t k = argi->nearest_arg > 0
+			? (size_t)argi->nearest_arg : 1U;
+		const long int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		const size_t dth = ncpu > 0 ? (size_t)ncpu : 1U;
+		/* hsh_flush() keeps per-thread state on the stack, and
+		 * beyond a few threads per processor nothing's gained */
+		const size_t nth = argi->threads_given && argi->threads_arg > 0
+			? (size_t)argi->threads_arg < 4U * dth
+			? (size_t)argi->threads_arg : 4U * dth
+			: dth;
+		struct hsh_qry_s q = {
+			.c = (const uint64_t*)(hdr + 1U),
+			.nc = hdr->ncode,
+			.nw = nw,
+			.q = malloc(nb * nw * sizeof(*q.q)),
+			.nb = nb,
+			.k = k,
+			.nth = nth,
+			.key = malloc(nth * nb * k * sizeof(*q.key)),
+			.mk = malloc(nth * k * sizeof(*q.mk)),
+			.zmk = nth * k,
+			.rad = argi->radius_given && argi->radius_arg >= 0
+			? (size_t)argi->radius_arg : SIZE_MAX,
+			.out = stdout,
+		};
+		glodfn_t xf = {.fd = -1};
+		struct mih_s ix;
+
+		if (argi->radius_given) {
+			/* radius queries go through the index if there's one */
+			char fn[PATH_MAX];
+
+			snprintf(fn, sizeof(fn), "%s" MIH_SFX, cfn);
+			if ((xf = mmap_fn(fn, O_RDONLY, mfl)).fb.d == NULL) {
+				;
+			} else if (mih_view(&ix, xf.fb, hdr) < 0) {
+				fprintf(stderr, "\
+index `%s' doesn't fit `%s', scanning all codes\n", fn, cfn);
+			} else if (mih_nprb(&ix, q.rad) > ix.ncode) {
+				/* probing every substring within the
+				 * radius costs more than a scan */
+				if (argi->verbose_given) {
+					fprintf(stderr, "\
+radius %zu too large for index `%s', scanning all codes\n", q.rad, fn);
+				}
+			} else {
+				q.ix = &ix;
+			}
 		}
-		signal(SIGINT, si_prop);
 
 		init_rand();
-		init_drbctx(ctx, m);
-
-		for (spsv_t sv; (sv = read_tf(fd)).z; prop(ctx, sv, smplp));
+		if (UNLIKELY(q.q == NULL || q.key == NULL || q.mk == NULL ||
+			     init_drbctx(ctx, m, false) < 0 ||
+			     each_hid(ctx, nb, hsh_qrow, &q) < 0 ||
+			     (q.nq && hsh_flush(&q) < 0))) {
+			perror("cannot query");
+			res = 1;
+		}
 
-	prop_xit:
-		/* just to deinitialise resources */
-		(void)read_tf(-1);
+		free(q.q);
+		free(q.key);
+		free(q.mk);
+		(void)munmap_fn(xf);
 		fini_drbctx(ctx);
-		dump(m);
 		deinit_rand();
 	}
 
+	(void)munmap_fn(cf);
+	(void)read_tf(-1);
+	dump(m);
 	return res;
 }
 
 static int
-cmd_info(struct glod_args_info argi[static 1])
+cmd_compact(struct glod_args_info argi[static 1])
+{
+/* fold journals into their machine files, pump() does all the work */
+	int res = 0;
+
+	for (unsigned int i = 1; i < argi->inputs_num; i++) {
+		const char *f = argi->inputs[i];
+		dl_rbm_t m;
+
+		if ((m = pump(f, O_RDWR)) == NULL) {
+			fprintf(stderr, "error compacting machine file `%s'\n", f);
+			res = 1;
+			continue;
+		}
+		res |= dump(m) < 0;
+	}
+	return res;
+}
+
+static int
+upgr(const char *file)
+{
+/* convert unversioned machine FILE, the new machine is built in a
+ * temporary next to FILE and renamed over it, current files are
+ * left alone */
+	char tmp[PATH_MAX];
+	struct stat st;
+	glodfn_t of;
+	const float *sp;
+	dl_rbm_t m;
+	int fd;
+
+	if (UNLIKELY((of = mmap_fn(file, O_RDONLY, MAP_PRIVATE)).fd < 0)) {
+		fprintf(stderr, "error loading machine file `%s'\n", file);
+		return -1;
+	} else if (!chk_hdr(of.fb.d, of.fb.z)) {
+		/* nothing to do */
+		return munmap_fn(of);
+	} else if (UNLIKELY((sp = v0_data(of.fb.d, of.fb.z)) == NULL)) {
+		fprintf(stderr, "\
+machine file `%s' is of no format known to us\n", file);
+		goto out;
+	} else if (UNLIKELY(fstat(of.fd, &st) < 0)) {
+		goto out;
+	} else if (UNLIKELY((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX",
+					     file) >= sizeof(tmp))) {
+		goto out;
+	} else if (UNLIKELY((fd = mkstemp(tmp)) < 0)) {
+		goto out;
+	}
+	close(fd);
+
+	with (const struct dl_file_v0_s *fl = of.fb.d) {
+		const struct dl_spec_s dim = {fl->nvis, fl->nhid};
+		const struct dl_spec_s cap = {0U, 0U};
+
+		if (UNLIKELY((m = crea(tmp, dim, cap, DL_FL_NONE,
+				       DL_ET_F32)) == NULL)) {
+			goto unl;
+		}
+	}
+	memcpy(m->vbias, sp, m->nvis * sizeof(*m->vbias));
+	sp += m->nvis;
+	memcpy(m->hbias, sp, m->nhid * sizeof(*m->hbias));
+	sp += m->nhid;
+	for (size_t i = 0; i < m->nvis; i++, sp += m->nhid) {
+		memcpy((float*)m->w + i * m->ldw, sp, m->nhid * sizeof(*sp));
+	}
+	if (UNLIKELY(dump(m) < 0)) {
+		goto unl;
+	} else if (UNLIKELY(chmod(tmp, st.st_mode & 07777) < 0 ||
+			    rename(tmp, file) < 0)) {
+		goto unl;
+	}
+	return munmap_fn(of);
+
+unl:
+	unlink(tmp);
+out:
+	fprintf(stderr, "error upgrading machine file `%s'\n", file);
+	(void)munmap_fn(of);
+	return -1;
+}
+
+static int
+cmd_upgrade(struct glod_args_info argi[static 1])
+{
+	int res = 0;
+
+	/* crea() initialises the machine before we overwrite it */
+	init_rand();
+	for (unsigned int i = 1; i < argi->inputs_num; i++) {
+		res |= upgr(argi->inputs[i]) < 0;
+	}
+	deinit_rand();
+	return res;
+}
+
+static int
+q8_calib(dl_rbm_t m, const char *file)
+{
+/* prop documents on stdin through M's int8 and its full weights and
+ * report the largest differences */
+	static struct drbctx_s ctx[1];
+	const size_t nh = m->nhid;
+	float maxa = 0.f;
+	float maxp = 0.f;
+	size_t nd = 0U;
+
+	if (UNLIKELY(wtr_of(m) == NULL)) {
+		return -1;
+	} else if (UNLIKELY(init_drbctx(ctx, m, false) < 0)) {
+		return -1;
+	}
+	for (spsv_t sv; (sv = read_tf(STDIN_FILENO)).z; nd++) {
+		const float *r = ((const struct dl_rbm_priv_s*)m->priv)->q8s;
+
+		(void)popul_sv(ctx->vo, m->nvis, sv);
+		quant_vis(ctx->vq, &ctx->vqs, ctx->vo, r, m->nvis);
+		prop_up(ctx->ho, m, ctx->vo);
+		prop_up_q8(ctx->hr, m, ctx->vq, ctx->vqs);
+
+		for (size_t j = 0; j < nh; j++) {
+			const float da = fabsf(ctx->ho[j] - ctx->hr[j]);
+			const float dp = fabsf(sigma(ctx->ho[j]) - sigma(ctx->hr[j]));
+
+			maxa = da > maxa ? da : maxa;
+			maxp = dp > maxp ? dp : maxp;
+		}
+	}
+	(void)read_tf(-1);
+	fini_drbctx(ctx);
+
+	printf("%s\t%zu documents\tmax activation error %g\t\
+max probability error %g\n", file, nd, maxa, maxp);
+	return 0;
+}
+
+static int
+cmd_quantize(struct glod_args_info argi[static 1])
 {
 	int res = 0;
 
+	if (argi->calibrate_given && argi->inputs_num != 2) {
+		fputs("--calibrate needs exactly one machine file\n", stderr);
+		return 1;
+	}
+	init_rand();
 	for (unsigned int i = 1; i < argi->inputs_num; i++) {
 		const char *f = argi->inputs[i];
 		dl_rbm_t m;
 
-		if ((m = pump(f, O_RDONLY)) == NULL) {
+		if ((m = pump(f, O_RDWR)) == NULL) {
+			fprintf(stderr, "error loading machine file `%s'\n", f);
+			res = 1;
+			continue;
+		}
+		/* resz() lays out the int8 sections and fills them */
+		with (struct dl_spec_s dim = {m->nvis, m->nhid}, cap = {0U, 0U}) {
+			if (UNLIKELY(resz(m, dim, cap, DL_FL_Q8, DL_ET_UNK) < 0)) {
+				fprintf(stderr, "\
+error quantising machine file `%s'\n", f);
+				res = 1;
+			} else if (argi->calibrate_given &&
+				   UNLIKELY(q8_calib(m, f) < 0)) {
+				res = 1;
+			}
+		}
+		res |= dump(m) < 0;
+	}
+	deinit_rand();
+	return res;
+}
+
+static int
+cmd_info(struct glod_args_info argi[static 1])
+{
+	int res = 0;
+
+	for (unsigned int i = 1; i < argi->inputs_num; i++) {
+		const char *f = argi->inputs[i];
+		struct dl_file_s fl;
+
+		/* the header is all we need, don't map the rest */
+		if (peek(&fl, f) < 0) {
 			fprintf(stderr, "error opening machine file `%s'\n", f);
 			res = 1;
+			continue;
 		}
 
 		/* just a general overview */
-		printf("%s\t%zux%zu\tpoiss->binary\n", f, m->nvis, m->nhid);
-
-		/* and close the resources assoc'd with m again */
-		dump(m);
+		printf("%s\t%zux%zu\t%s%s%s%s%s\n", f,
+		       (size_t)fl.nvis, (size_t)fl.nhid,
+		       mtype_names[fl.mtype],
+		       fl.flags & DL_FL_WTR ? "\ttransposed" : "",
+		       fl.etype != DL_ET_F32 ? "\t" : "",
+		       fl.etype != DL_ET_F32 ? etype_names[fl.etype] : "",
+		       fl.flags & DL_FL_Q8 ? "\tint8" : "");
 	}
 	return res;
 }
@@ -1338,6 +5951,15 @@ main(int argc, char *argv[])
 		goto out;
 	}
 
+	/* memory placement, before anything big is allocated */
+	if (argi->hugetlb_given) {
+		mem_fl |= MEM_HUGETLB;
+	}
+	if (argi->interleave_given && numa_ilv() < 0) {
+		fputs("cannot interleave memory over NUMA nodes, "
+		      "carrying on\n", stderr);
+	}
+
 	/* check the command */
 	with (const char *cmd = argi->inputs[0]) {
 		if (!strcmp(cmd, "train")) {
@@ -1352,6 +5974,24 @@ main(int argc, char *argv[])
 		} else if (!strcmp(cmd, "info")) {
 			res = cmd_info(argi);
 
+		} else if (!strcmp(cmd, "compact")) {
+			res = cmd_compact(argi);
+
+		} else if (!strcmp(cmd, "upgrade")) {
+			res = cmd_upgrade(argi);
+
+		} else if (!strcmp(cmd, "quantize")) {
+			res = cmd_quantize(argi);
+
+		} else if (!strcmp(cmd, "serve")) {
+			res = cmd_serve(argi);
+
+		} else if (!strcmp(cmd, "hash")) {
+			res = cmd_hash(argi);
+
+		} else if (!strcmp(cmd, "query")) {
+			res = cmd_query(argi);
+
 		} else {
 			/* otherwise print help and bugger off */
 			glod_parser_print_help();
@@ -1363,5 +6003,6 @@ out:
 	glod_parser_free(argi);
 	return res;
 }
+#endif	/* !LIBRBM */
 
 /* rbm.c ends here */
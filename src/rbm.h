@@ -0,0 +1,116 @@
+/*** rbm.h -- restricted boltzmann machines, embeddable
+ *
+ * Copyright (C) 2008-2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@fresse.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if !defined INCLUDED_rbm_h_
+#define INCLUDED_rbm_h_
+
+#include <stddef.h>
+
+/**
+ * A machine, as read from a machine file by rbm_open(). */
+typedef struct rbm_s *rbm_t;
+
+/**
+ * A propagation context, scratch space for one thread to propagate
+ * documents through a machine. */
+typedef struct rbm_ctx_s *rbm_ctx_t;
+
+/**
+ * A batch of documents in compressed sparse row form.
+ * Document D consists of terms IDX[PTR[D]] .. IDX[PTR[D + 1] - 1]
+ * with counts CNT[PTR[D]] .. CNT[PTR[D + 1] - 1], i.e. PTR must hold
+ * NDOC + 1 offsets.  Terms beyond the visible layer are ignored. */
+typedef struct rbm_csr_s rbm_csr_t;
+
+struct rbm_csr_s {
+	size_t ndoc;
+	const size_t *ptr;
+	const size_t *idx;
+	const float *cnt;
+};
+
+/**
+ * Flags for rbm_open(). */
+typedef enum {
+	RBM_OPEN_MAPPED = 0U,
+	/** read the machine into (huge page backed) anonymous memory */
+	RBM_OPEN_IN_CORE = 1U,
+} rbm_open_fl_t;
+
+
+/**
+ * Open the machine in FILE, replaying its journal, if any.
+ * Machine files are never written to.
+ * Return NULL and set errno on failure. */
+extern rbm_t rbm_open(const char *file, rbm_open_fl_t flags);
+
+/**
+ * Close machine M, all contexts on M must have been freed. */
+extern int rbm_close(rbm_t m);
+
+/**
+ * Return the number of visible units of M. */
+extern size_t rbm_nvis(rbm_t m);
+
+/**
+ * Return the number of hidden units of M. */
+extern size_t rbm_nhid(rbm_t m);
+
+/**
+ * Return a new propagation context for machine M, or NULL on failure.
+ * Contexts on the same machine can be used from different threads
+ * concurrently, a context itself cannot. */
+extern rbm_ctx_t rbm_ctx_new(rbm_t m);
+
+/**
+ * Free context CTX. */
+extern void rbm_ctx_free(rbm_ctx_t ctx);
+
+/**
+ * Propagate the documents DOCS up through CTX's machine and store the
+ * hidden units' expectations in row-major matrix OUT, one row of
+ * rbm_nhid() floats per document.
+ * Return 0 on success, -1 otherwise. */
+extern int
+rbm_prop_batch(rbm_ctx_t ctx, const rbm_csr_t *docs, float *out);
+
+/**
+ * Like rbm_prop_batch() but store samples (0 or 1) of the hidden units.
+ * Each thread has a random number generator of its own, seeded on the
+ * thread's first call, so contexts may sample from different threads
+ * concurrently. */
+extern int
+rbm_smpl_batch(rbm_ctx_t ctx, const rbm_csr_t *docs, float *out);
+
+#endif	/* INCLUDED_rbm_h_ */
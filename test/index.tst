@@ -0,0 +1,23 @@
+## hash in two goes, the index must match that of hashing in one go,
+## and queries answered through the index must match a full scan
+
+$ rm -rf index.tmpd && mkdir index.tmpd && \
+for n in 0 150; do \
+	awk -v n=$n 'BEGIN{for(d=n;d<n+150;d++){for(i=0;i<6;i++)print (d*11+i*i*7+i)%64 "\t" 1+(i*d)%4; print "\f"}}' \
+		> index.tmpd/docs$n; \
+done && \
+cat index.tmpd/docs0 index.tmpd/docs150 > index.tmpd/docs && \
+head -n 21 index.tmpd/docs > index.tmpd/qry
+$ rbm init -d 64x64 index.tmpd/m.rbm
+$ rbm hash --index 4 index.tmpd/m.rbm index.tmpd/a < index.tmpd/docs0 > /dev/null && \
+rbm hash --append index.tmpd/m.rbm index.tmpd/a < index.tmpd/docs150 > /dev/null
+$ rbm hash --index 4 index.tmpd/m.rbm index.tmpd/b < index.tmpd/docs > /dev/null && \
+cmp index.tmpd/a index.tmpd/b && \
+cmp index.tmpd/a.mih index.tmpd/b.mih
+$ rbm query -v -n 1000 --radius 6 index.tmpd/m.rbm index.tmpd/a \
+	< index.tmpd/qry > index.tmpd/qa 2> index.tmpd/err && \
+! test -s index.tmpd/err
+$ cp index.tmpd/b index.tmpd/c && \
+rbm query -n 1000 --radius 6 index.tmpd/m.rbm index.tmpd/c < index.tmpd/qry
+< index.tmpd/qa
+$
@@ -0,0 +1,21 @@
+## train --journal, tear the journal's tail, train on, compact
+
+$ rm -rf journal.tmpd && mkdir journal.tmpd && \
+awk 'BEGIN{for(d=0;d<200;d++){for(i=0;i<8;i++)print (d*7+i*13)%64 "\t" 1+(i+d)%5; print "\f"}}' \
+	> journal.tmpd/docs
+$ rbm init -d 64x16 journal.tmpd/m.rbm
+$ rbm train --journal journal.tmpd/m.rbm < journal.tmpd/docs > /dev/null && \
+test -s journal.tmpd/m.rbm.jnl
+$ rbm prop --in-core journal.tmpd/m.rbm < journal.tmpd/docs > journal.tmpd/a
+$ rbm prop journal.tmpd/m.rbm < journal.tmpd/docs > journal.tmpd/b && \
+cmp journal.tmpd/a journal.tmpd/b
+$ printf 'torn record' >> journal.tmpd/m.rbm.jnl
+$ rbm prop --in-core journal.tmpd/m.rbm < journal.tmpd/docs > journal.tmpd/b && \
+cmp journal.tmpd/a journal.tmpd/b
+$ rbm train --journal journal.tmpd/m.rbm < journal.tmpd/docs > /dev/null
+$ rbm prop --in-core journal.tmpd/m.rbm < journal.tmpd/docs > journal.tmpd/c && \
+! cmp -s journal.tmpd/a journal.tmpd/c
+$ rbm compact journal.tmpd/m.rbm && ! test -e journal.tmpd/m.rbm.jnl
+$ rbm prop journal.tmpd/m.rbm < journal.tmpd/docs
+< journal.tmpd/c
+$
@@ -0,0 +1,26 @@
+## a 4x2 machine in the unversioned format, little-endian:
+## hbias (0, -1), rows of W (1, 0), (0, 1), (-1, 0), (0, 0)
+## debug builds dump layer ranges to stdout, hence the grep
+
+$ rm -rf upgrade.tmpd && mkdir upgrade.tmpd && \
+z='\0\0\0\0' o='\0\0\200\77' m='\0\0\200\277' && \
+printf "$z$z"'\4\0\0\0\0\0\0\0\2\0\0\0\0\0\0\0'"$z$z" > upgrade.tmpd/m.rbm && \
+printf "$z$z$z$z$z$m$o$z$z$o$m$z$z$z" >> upgrade.tmpd/m.rbm && \
+printf '0\t1\n\f\n1\t1\n\f\n2\t1\n\f\n0\t2\n\f\n' > upgrade.tmpd/docs
+$ ! rbm info upgrade.tmpd/m.rbm 2> /dev/null
+$ rbm upgrade upgrade.tmpd/m.rbm
+$ rbm info upgrade.tmpd/m.rbm
+upgrade.tmpd/m.rbm	4x2	poiss->binary
+$ rbm prop upgrade.tmpd/m.rbm < upgrade.tmpd/docs | grep -v '('
+0.731059
+0.268941
+0.5
+0.5
+0.268941
+0.268941
+0.880797
+0.268941
+$ cp upgrade.tmpd/m.rbm upgrade.tmpd/m.v1 && \
+rbm upgrade upgrade.tmpd/m.rbm && \
+cmp upgrade.tmpd/m.rbm upgrade.tmpd/m.v1
+$